@@ -0,0 +1,126 @@
+#include <algorithm>
+#include "../execution/context.hpp"
+#include "../parsing/optimizer.hpp"
+#include "../parsing/parser.hpp"
+#include "engine.hpp"
+
+using namespace std;
+
+// ==== Embedding API implementation ====
+
+CompiledExpression::CompiledExpression(Expression expression) :
+    expression(std::move(expression)), variables(this->expression.variable_names())
+{}
+
+EvaluationResult::EvaluationResult() :
+    succeeded(false), value_type(RATIONAL_NUMBER), number(RationalNumber()), rows_(0), cols_(0),
+    elements(vector<RationalNumber>())
+{}
+
+Engine::Engine() :
+    context(new Context()), bindings(vector<Binding>())
+{
+    context->result_cache().set_budget(0);
+}
+
+Engine::~Engine()
+{
+    delete context;
+}
+
+CompiledExpression Engine::compile(const string& text)
+{
+    return CompiledExpression(optimize_expression(parse_expression(text)));
+}
+
+bool Engine::load_plugin(const string& path)
+{
+    string error;
+    return KernelRegistry::shared().load_plugin(path, error);
+}
+
+bool Engine::set(const string& name, const RationalNumber& value)
+{
+    if (!is_correct_var_name(name))
+        return false;
+    unbind(name);
+    Arena::Scope heap(nullptr);
+    context->update_variable(name, new RationalNumber(value));
+    return true;
+}
+
+bool Engine::set(const string& name, const Matrix& value)
+{
+    if (!is_correct_var_name(name))
+        return false;
+    unbind(name);
+    Arena::Scope heap(nullptr);
+    context->update_variable(name, new Matrix(value));
+    return true;
+}
+
+// The matrix is allocated once here and refilled by the evaluations reading it
+bool Engine::bind(const string& name, const int* numerators, const int* denominators, int rows, int cols)
+{
+    if (!is_correct_var_name(name) || numerators == nullptr || rows <= 0 || cols <= 0)
+        return false;
+    unbind(name);
+    Arena::Scope heap(nullptr);
+    auto matrix = new Matrix(rows, cols);
+    context->update_variable(name, matrix);
+    bindings.push_back(Binding{name, numerators, denominators, matrix});
+    return true;
+}
+
+void Engine::unbind(const string& name)
+{
+    bindings.erase(remove_if(bindings.begin(), bindings.end(),
+                             [&name](const Binding& binding) { return binding.name == name; }),
+                   bindings.end());
+}
+
+bool Engine::read_bound(const CompiledExpression& expression)
+{
+    for (const Binding& binding : bindings)
+    {
+        if (find(expression.variables.begin(), expression.variables.end(), binding.name) == expression.variables.end())
+            continue;
+        Matrix& matrix = *binding.value;
+        for (int i = 0, k = 0; i != matrix.rows(); i++)
+            for (int j = 0; j != matrix.cols(); j++, k++)
+            {
+                int denominator = binding.denominators != nullptr ? binding.denominators[k] : 1;
+                if (denominator <= 0)
+                    return false;
+                matrix.at(i, j) = RationalNumber::reduced(binding.numerators[k], denominator);
+            }
+    }
+    return true;
+}
+
+bool Engine::evaluate(const CompiledExpression& expression, EvaluationResult& result)
+{
+    result.succeeded = read_bound(expression) && context->expression_to_TEMP(expression.expression);
+    if (result.succeeded)
+    {
+        GenericValue* value = context->get_variable(Context::TEMP_VAR);
+        result.value_type = value->get_type();
+        if (result.value_type == RATIONAL_NUMBER)
+        {
+            result.number = *static_cast<RationalNumber*>(value);
+            result.rows_ = result.cols_ = 0;
+        }
+        else
+        {
+            auto matrix = static_cast<Matrix*>(value);
+            result.rows_ = matrix->rows();
+            result.cols_ = matrix->cols();
+            result.elements.resize(size_t(result.rows_) * result.cols_);
+            for (int i = 0; i != result.rows_; i++)
+                copy(&matrix->at(i, 0), &matrix->at(i, 0) + result.cols_,
+                     result.elements.begin() + ptrdiff_t(i) * result.cols_);
+        }
+    }
+    context->clear_TEMP();
+    return result.succeeded;
+}
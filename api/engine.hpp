@@ -0,0 +1,89 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "../parsing/expression.hpp"
+#include "../types/var_types.hpp"
+
+struct Context;
+
+// ==== Embedding API declaration ====
+
+// Interpreter core for C++ callers, without a process or text in between. An Engine owns
+// one Context: expressions are parsed and optimized once by compile() and evaluated any
+// number of times against the engine's variables. Matrices can be bound to plain int arrays in
+// caller memory, which every evaluation reads again, so the caller may update the elements in
+// place between evaluations; for that reason the engine keeps the result cache off. An Engine must not be used by two threads at once,
+// separate engines may run concurrently.
+
+struct CompiledExpression
+{
+    inline bool is_correct() const { return expression.is_correct(); }
+    inline std::string to_string() const { return expression.to_string(); }
+private:
+    friend struct Engine;
+    explicit CompiledExpression(Expression expression);
+    Expression expression;
+    std::vector<std::string> variables;
+};
+
+// Value of an evaluation, copied out of the interpreter. Its storage is reused, so
+// evaluating into the same Result again does not allocate unless the result grows.
+struct EvaluationResult
+{
+    EvaluationResult();
+
+    inline bool ok() const { return succeeded; }
+    inline ValueType type() const { return value_type; }
+    inline const RationalNumber& scalar() const { return number; }
+    inline int rows() const { return rows_; }
+    inline int cols() const { return cols_; }
+    inline const RationalNumber& at(int i, int j) const { return elements[std::size_t(i) * cols_ + j]; }
+    // rows() * cols() elements in row-major order
+    inline const RationalNumber* data() const { return elements.data(); }
+private:
+    friend struct Engine;
+    bool succeeded;
+    ValueType value_type;
+    RationalNumber number;
+    int rows_;
+    int cols_;
+    std::vector<RationalNumber> elements;
+};
+
+struct Engine
+{
+    Engine();
+    ~Engine();
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    static CompiledExpression compile(const std::string& text);
+    // Kernels of a plugin become callable in every engine; plugins are loaded before evaluating
+    static bool load_plugin(const std::string& path);
+
+    // Copies the value into the variable
+    bool set(const std::string& name, const RationalNumber& value);
+    bool set(const std::string& name, const Matrix& value);
+    // The variable is the rows * cols row-major matrix of numerators[k] / denominators[k],
+    // read from the caller's arrays by every evaluation using it. Each number must be in lowest
+    // terms with a positive denominator; without denominators the elements are integers.
+    // The arrays must stay alive until the variable is set or bound again or the engine is destroyed.
+    bool bind(const std::string& name, const int* numerators, const int* denominators, int rows, int cols);
+
+    // Fails if a bound array holds a denominator that is not positive
+    bool evaluate(const CompiledExpression& expression, EvaluationResult& result);
+private:
+    struct Binding
+    {
+        std::string name;
+        const int* numerators;
+        const int* denominators;
+        // Owned by the variable, which only set() and bind() replace
+        Matrix* value;
+    };
+    void unbind(const std::string& name);
+    bool read_bound(const CompiledExpression& expression);
+
+    Context* context;
+    std::vector<Binding> bindings;
+};
@@ -0,0 +1,416 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include "../api/engine.hpp"
+#include "../execution/kernel_registry.hpp"
+#include "../main/interpreter.hpp"
+#include "load_client.hpp"
+#include "workload.hpp"
+
+// Benchmark build from math_interpreter root directory:
+// c++ -O2 bench/*.cpp api/*.cpp parsing/*.cpp types/*.cpp execution/*.cpp main/interpreter.cpp -o benchmark.exe
+//
+// Usage: benchmark.exe [--quick] [--filter text] [--repetitions N] [--seed N]
+//        benchmark.exe --emit-script statements size [--seed N]
+//        benchmark.exe --load socket_path [--clients N] [--statements N] [--size N] [--seed N]
+// Results are printed to stdout as one JSON document; --emit-script prints a generated script instead.
+// --load drives a running interpreter.exe --serve socket_path with concurrent client sessions
+
+using namespace std;
+
+struct Settings
+{
+    bool quick;
+    string filter;
+    int repetitions;
+    uint64_t seed;
+    double min_time_ns;
+};
+
+struct Measurement
+{
+    string name;
+    int size;
+    long iterations;
+    vector<double> ns_per_op;
+};
+
+static Settings settings = {false, string(), 10, 42, 2e7};
+static vector<Measurement> measurements;
+static volatile long sink;
+
+// Swallows everything the interpreter prints while a script is timed
+struct NullBuffer : streambuf
+{
+protected:
+    int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+    streamsize xsputn(const char*, streamsize count) override { return count; }
+};
+
+static double time_iterations(const function<void()>& operation, long iterations)
+{
+    auto start = chrono::steady_clock::now();
+    for (long i = 0; i != iterations; i++)
+        operation();
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+}
+
+// The iteration count is calibrated so that one repetition takes at least min_time_ns,
+// the calibration runs double as warm-up. Every repetition is then timed on its own.
+static void measure(const string& name, int size, const function<void()>& operation)
+{
+    if (name.find(settings.filter) == string::npos)
+        return;
+    long iterations = 1;
+    while (true)
+    {
+        double elapsed = time_iterations(operation, iterations);
+        if (elapsed >= settings.min_time_ns || iterations >= (1L << 30))
+            break;
+        iterations *= (elapsed * 10 < settings.min_time_ns) ? 10 : 2;
+    }
+
+    Measurement measurement = {name, size, iterations, vector<double>()};
+    for (int r = 0; r != settings.repetitions; r++)
+        measurement.ns_per_op.push_back(time_iterations(operation, iterations) / iterations);
+    measurements.push_back(measurement);
+    cerr << name << " " << size << ": " << measurement.ns_per_op.front() << " ns" << endl;
+}
+
+// ==== Benchmarks ====
+
+static void parser_benchmarks(Workload& workload)
+{
+    vector<string> lines = {
+        "x = 3/4 + 1/2 * y",
+        "A = " + workload.integer_matrix(4, 4),
+        "B = " + workload.rational_matrix(16, 16),
+        "C = T(A * B) + -(A - B) * 2",
+        "A * B + C - T(D)",
+    };
+    istringstream no_continuations;
+    SourceReader source(no_continuations);
+    size_t next = 0;
+    measure("parse_command", int(lines.size()), [&]
+    {
+        Command* command = parse_command(lines[next++ % lines.size()], source);
+        sink = sink + command->code();
+        delete command;
+    });
+}
+
+static void rational_benchmarks(Workload& workload)
+{
+    const size_t count = 1024;
+    vector<RationalNumber> left, right;
+    vector<pair<int, int>> fractions;
+    for (size_t i = 0; i != count; i++)
+    {
+        left.emplace_back(workload.integer(-1000, 1000), workload.integer(1, 100));
+        right.emplace_back(workload.integer(-1000, 1000), workload.integer(1, 100));
+        fractions.emplace_back(workload.integer(-100000, 100000), workload.integer(1, 1000));
+    }
+    size_t next = 0;
+    measure("rational_add", 1, [&]
+    {
+        size_t i = next++ % count;
+        sink = sink + (left[i] + right[i]).num();
+    });
+    measure("rational_mul", 1, [&]
+    {
+        size_t i = next++ % count;
+        sink = sink + (left[i] * right[i]).num();
+    });
+    measure("rational_simplify", 1, [&]
+    {
+        const pair<int, int>& fraction = fractions[next++ % count];
+        sink = sink + RationalNumber(fraction.first, fraction.second).den();
+    });
+}
+
+static void matrix_benchmarks(Workload& workload)
+{
+    for (int size : {4, 16, 64, 256, 1024})
+    {
+        if (settings.quick && size > 256)
+            break;
+        Matrix a(workload.integer_matrix(size, size)), b(workload.integer_matrix(size, size));
+        measure("matrix_add", size, [&] { sink = sink + (a + b).rows(); });
+        measure("matrix_mul", size, [&] { sink = sink + (a * b).rows(); });
+        measure("matrix_hadamard", size, [&] { sink = sink + a.hadamard_product(b).rows(); });
+        measure("matrix_sum", size, [&] { sink = sink + a.sum().den(); });
+        measure("matrix_frobenius2", size, [&] { sink = sink + a.frobenius2().den(); });
+        measure("matrix_transpose", size, [&]
+        {
+            a.transpose();
+            sink = sink + a.rows();
+        });
+    }
+}
+
+// Compiled once, evaluated against integer matrices bound from caller memory
+static void engine_benchmarks(Workload& workload)
+{
+    for (int size : {4, 16, 64})
+    {
+        Matrix a(workload.integer_matrix(size, size)), b(workload.integer_matrix(size, size));
+        vector<int> left(size_t(size) * size), right(size_t(size) * size);
+        for (int i = 0; i != size; i++)
+            for (int j = 0; j != size; j++)
+            {
+                left[size_t(i) * size + j] = a.at(i, j).num();
+                right[size_t(i) * size + j] = b.at(i, j).num();
+            }
+        Engine engine;
+        engine.bind("A", left.data(), nullptr, size, size);
+        engine.bind("B", right.data(), nullptr, size, size);
+        CompiledExpression expression = Engine::compile("A * B + A");
+        EvaluationResult result;
+        measure("engine_evaluate", size, [&]
+        {
+            engine.evaluate(expression, result);
+            sink = sink + result.rows();
+        });
+    }
+}
+
+static bool negate_copy(GenericValue* const* arguments, GenericValue** result)
+{
+    auto matrix = static_cast<Matrix*>(arguments[0]);
+    auto negated = new Matrix(*matrix);
+    for (int i = 0; i != negated->rows(); i++)
+        for (int j = 0; j != negated->cols(); j++)
+            negated->at(i, j) = -negated->at(i, j);
+    *result = negated;
+    return true;
+}
+
+static bool negate_in_place(Matrix& target, GenericValue* const*)
+{
+    for (int i = 0; i != target.rows(); i++)
+        for (int j = 0; j != target.cols(); j++)
+            target.at(i, j) = -target.at(i, j);
+    return true;
+}
+
+// The same registered kernel copying its argument and updating the temporary it is given
+static void kernel_benchmarks(Workload& workload)
+{
+    KernelRegistry::shared().add("bench_negate_copy", {PARAMETER_MATRIX}, negate_copy);
+    KernelRegistry::shared().add_in_place("bench_negate_in_place", {PARAMETER_MATRIX}, negate_in_place);
+    for (int size : {16, 64, 128})
+    {
+        if (settings.quick && size > 64)
+            break;
+        Engine engine;
+        engine.set("A", Matrix(workload.integer_matrix(size, size)));
+        engine.set("B", Matrix(workload.integer_matrix(size, size)));
+        EvaluationResult result;
+        for (bool in_place : {false, true})
+        {
+            CompiledExpression expression = Engine::compile(in_place ? "bench_negate_in_place(A + B)" : "bench_negate_copy(A + B)");
+            measure(in_place ? "kernel_in_place" : "kernel_copy", size, [&]
+            {
+                engine.evaluate(expression, result);
+                sink = sink + result.rows();
+            });
+        }
+    }
+}
+
+static void script_benchmarks(Workload& workload)
+{
+    string path = (filesystem::temp_directory_path() / "math_interpreter_bench.program").string();
+    NullBuffer null_buffer;
+    for (int size : {8, 32, 64})
+    {
+        if (settings.quick && size > 32)
+            break;
+        {
+            ofstream script(path);
+            script << workload.script(200, size);
+        }
+        for (const char* mode : {"script", "script_parallel", "script_async"})
+        {
+            bool parallel = strcmp(mode, "script_parallel") == 0, async = strcmp(mode, "script_async") == 0;
+            Interpreter::Options options = {false, false, ResultCache::DEFAULT_BUDGET, parallel, false, false, nullptr, 0, async};
+            measure(mode, size, [&]
+            {
+                streambuf* previous = cout.rdbuf(&null_buffer);
+                {
+                    Interpreter interpreter(path.c_str(), options);
+                    interpreter.run();
+                }
+                cout.rdbuf(previous);
+            });
+        }
+    }
+    filesystem::remove(path);
+}
+
+// A generated script with all variables in memory and under a budget that keeps spilling them
+static void memory_benchmarks(Workload& workload)
+{
+    string path = (filesystem::temp_directory_path() / "math_interpreter_memory.program").string();
+    NullBuffer null_buffer;
+    const int size = 32;
+    {
+        ofstream script(path);
+        script << workload.script(200, size);
+    }
+    for (size_t budget : {size_t(0), Matrix::byte_size(size, size) * 4})
+    {
+        Interpreter::Options options = {false, false, ResultCache::DEFAULT_BUDGET, false, false, false, nullptr, budget, false};
+        measure(budget == 0 ? "script_resident" : "script_spilling", size, [&]
+        {
+            streambuf* previous = cout.rdbuf(&null_buffer);
+            {
+                Interpreter interpreter(path.c_str(), options);
+                interpreter.run();
+            }
+            cout.rdbuf(previous);
+        });
+    }
+    filesystem::remove(path);
+}
+
+// The same iteration as a repeat block parsed once and as unrolled lines parsed one by one.
+// Stepping with a permutation matrix keeps the entries from growing.
+static void repeat_benchmarks()
+{
+    string path = (filesystem::temp_directory_path() / "math_interpreter_repeat.program").string();
+    NullBuffer null_buffer;
+    const int size = 8, iterations = 500;
+    string setup = "P = [";
+    for (int i = 0; i != size; i++)
+        for (int j = 0; j != size; j++)
+            setup += string(j == 0 && i != 0 ? "; " : j != 0 ? " " : "") + (j == (i + 1) % size ? "1" : "0");
+    setup += "]\nx = P\n";
+    for (bool unrolled : {false, true})
+    {
+        {
+            ofstream script(path);
+            script << setup;
+            if (unrolled)
+                for (int k = 0; k != iterations; k++)
+                    script << "x = x * P\n";
+            else
+                script << "repeat " << iterations << " { x = x * P }\n";
+            script << "x\n";
+        }
+        Interpreter::Options options = {false, false, ResultCache::DEFAULT_BUDGET, false, false, false, nullptr, 0, false};
+        measure(unrolled ? "repeat_unrolled" : "repeat_block", iterations, [&]
+        {
+            streambuf* previous = cout.rdbuf(&null_buffer);
+            {
+                Interpreter interpreter(path.c_str(), options);
+                interpreter.run();
+            }
+            cout.rdbuf(previous);
+        });
+    }
+    filesystem::remove(path);
+}
+
+// ==== Report ====
+
+static void print_load_json(ostream& out, const LoadReport& report, int statements, int size)
+{
+    out << "{\n  \"suite\": \"math-interpreter-server\",\n  \"format\": 1,\n";
+    out << "  \"seed\": " << settings.seed << ",\n  \"clients\": " << report.clients
+        << ",\n  \"statements\": " << statements << ",\n  \"size\": " << size << ",\n";
+    out << "  \"requests\": " << report.requests << ",\n  \"failed_clients\": " << report.failed_clients
+        << ",\n  \"seconds\": " << report.seconds << ",\n  \"requests_per_second\": " << report.requests_per_second()
+        << ",\n  \"p50_us\": " << report.percentile_us(0.5) << ",\n  \"p99_us\": " << report.percentile_us(0.99)
+        << ",\n  \"max_us\": " << report.percentile_us(1.0) << "\n}" << endl;
+}
+
+static void print_json(ostream& out)
+{
+    out << "{\n  \"suite\": \"math-interpreter\",\n  \"format\": 1,\n";
+    out << "  \"seed\": " << settings.seed << ",\n  \"quick\": " << (settings.quick ? "true" : "false") << ",\n";
+    out << "  \"results\": [";
+    for (size_t k = 0; k != measurements.size(); k++)
+    {
+        vector<double> samples = measurements[k].ns_per_op;
+        sort(samples.begin(), samples.end());
+        double mean = 0, variance = 0;
+        for (double sample : samples)
+            mean += sample / samples.size();
+        for (double sample : samples)
+            variance += (sample - mean) * (sample - mean) / max<size_t>(1, samples.size() - 1);
+        size_t middle = samples.size() / 2;
+        double median = (samples.size() % 2 != 0) ? samples[middle] : (samples[middle - 1] + samples[middle]) / 2;
+
+        out << (k != 0 ? "," : "") << "\n    {\"name\": \"" << measurements[k].name << "\", \"size\": "
+            << measurements[k].size << ", \"iterations\": " << measurements[k].iterations
+            << ", \"repetitions\": " << samples.size() << ", \"min_ns\": " << samples.front()
+            << ", \"median_ns\": " << median << ", \"mean_ns\": " << mean
+            << ", \"stddev_ns\": " << sqrt(variance) << ", \"max_ns\": " << samples.back() << "}";
+    }
+    out << "\n  ]\n}" << endl;
+}
+
+int main(int argc, char const* argv[])
+{
+    int script_statements = 0, script_size = 0;
+    const char* load_socket = nullptr;
+    int load_clients = 16, load_statements = 200, load_size = 8;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+            settings.quick = true;
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            settings.filter = argv[++i];
+        else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc)
+            settings.repetitions = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            settings.seed = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--emit-script") == 0 && i + 2 < argc)
+        {
+            script_statements = atoi(argv[++i]);
+            script_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+            load_socket = argv[++i];
+        else if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc)
+            load_clients = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--statements") == 0 && i + 1 < argc)
+            load_statements = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+            load_size = max(1, atoi(argv[++i]));
+    }
+
+    Workload workload(settings.seed);
+    if (script_statements > 0 && script_size > 0)
+    {
+        cout << workload.script(script_statements, script_size);
+        return 0;
+    }
+    if (load_socket != nullptr)
+    {
+        LoadReport report = run_load(load_socket, load_clients, load_statements, load_size, settings.seed);
+        print_load_json(cout, report, load_statements, load_size);
+        return report.failed_clients == 0 ? 0 : 1;
+    }
+    if (settings.quick)
+        settings.repetitions = min(settings.repetitions, 5);
+
+    parser_benchmarks(workload);
+    rational_benchmarks(workload);
+    matrix_benchmarks(workload);
+    engine_benchmarks(workload);
+    kernel_benchmarks(workload);
+    script_benchmarks(workload);
+    memory_benchmarks(workload);
+    repeat_benchmarks();
+    print_json(cout);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include "load_client.hpp"
+#include "workload.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LOAD_SOCKETS
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// ==== Server load generator implementation ====
+
+double LoadReport::percentile_us(double fraction) const
+{
+    if (latencies_us.empty())
+        return 0.0;
+    size_t index = min(latencies_us.size() - 1, size_t(fraction * latencies_us.size()));
+    return latencies_us[index];
+}
+
+#ifdef LOAD_SOCKETS
+
+static int connect_session(const string& socket_path)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+        return -1;
+    strcpy(address.sun_path, socket_path.c_str());
+    int descriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (descriptor < 0)
+        return -1;
+    if (connect(descriptor, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close(descriptor);
+        return -1;
+    }
+    return descriptor;
+}
+
+// Reads until the reply ends with a prompt; the text of the reply is not kept
+static bool await_prompt(int descriptor)
+{
+    char buffer[4096];
+    char tail[3] = {0, 0, 0};
+    while (true)
+    {
+        ssize_t count = recv(descriptor, buffer, sizeof(buffer), 0);
+        if (count <= 0)
+            return false;
+        for (ssize_t i = 0; i != count; i++)
+        {
+            tail[0] = tail[1];
+            tail[1] = tail[2];
+            tail[2] = buffer[i];
+        }
+        if ((tail[0] == '=' && tail[1] == '>' && tail[2] == ' ') || (tail[0] == '.' && tail[1] == '.' && tail[2] == ' '))
+            return true;
+    }
+}
+
+static bool send_line(int descriptor, const string& line)
+{
+    size_t offset = 0;
+    while (offset != line.size())
+    {
+        ssize_t sent = send(descriptor, line.data() + offset, line.size() - offset, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return false;
+        offset += size_t(sent);
+    }
+    return true;
+}
+
+LoadReport run_load(const string& socket_path, int clients, int statements, int size, uint64_t seed)
+{
+    vector<vector<double>> latencies(clients);
+    vector<long> sent(clients, 0);
+    atomic<int> connected(0);
+    atomic<long> failed(0);
+    atomic<bool> start(false);
+    chrono::steady_clock::time_point started, finished;
+
+    vector<thread> threads;
+    for (int k = 0; k != clients; k++)
+        threads.emplace_back([&, k]
+        {
+            Workload workload(seed + uint64_t(k));
+            istringstream script(workload.script(statements, size));
+            int descriptor = connect_session(socket_path);
+            bool ready = descriptor >= 0 && await_prompt(descriptor);
+            connected++;
+            while (!start)
+                this_thread::yield();
+            if (!ready)
+            {
+                failed++;
+                if (descriptor >= 0)
+                    close(descriptor);
+                return;
+            }
+
+            string line;
+            while (getline(script, line))
+            {
+                auto request_start = chrono::steady_clock::now();
+                if (!send_line(descriptor, line + '\n') || !await_prompt(descriptor))
+                {
+                    failed++;
+                    break;
+                }
+                latencies[k].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - request_start).count());
+                sent[k]++;
+            }
+            close(descriptor);
+        });
+
+    while (connected != clients)
+        this_thread::yield();
+    started = chrono::steady_clock::now();
+    start = true;
+    for (thread& client : threads)
+        client.join();
+    finished = chrono::steady_clock::now();
+
+    LoadReport report = {clients, 0, failed.load(), chrono::duration<double>(finished - started).count(), vector<double>()};
+    for (int k = 0; k != clients; k++)
+    {
+        report.requests += sent[k];
+        report.latencies_us.insert(report.latencies_us.end(), latencies[k].begin(), latencies[k].end());
+    }
+    sort(report.latencies_us.begin(), report.latencies_us.end());
+    return report;
+}
+
+#else
+
+LoadReport run_load(const string&, int clients, int, int, uint64_t)
+{
+    return LoadReport{clients, 0, clients, 0.0, vector<double>()};
+}
+
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ==== Server load generator declaration ====
+
+// Closed-loop load for interpreter --serve: every client opens its own session, sends the
+// lines of its own generated script one at a time and waits for the prompt ending each reply
+// before sending the next one. Latencies are measured per line, throughput over the period
+// in which all clients were connected and sending.
+
+struct LoadReport
+{
+    int clients;
+    long requests;
+    long failed_clients;
+    double seconds;
+    std::vector<double> latencies_us;
+
+    inline double requests_per_second() const { return seconds > 0 ? requests / seconds : 0.0; }
+    double percentile_us(double fraction) const;
+};
+
+LoadReport run_load(const std::string& socket_path, int clients, int statements, int size, std::uint64_t seed);
@@ -0,0 +1,92 @@
+#include "workload.hpp"
+
+using namespace std;
+
+// ==== Workload generator implementation ====
+
+Workload::Workload(uint64_t seed) :
+    state(seed)
+{}
+
+// splitmix64: unlike the standard distributions its output is specified exactly
+uint64_t Workload::next()
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+int Workload::integer(int low, int high)
+{
+    return low + int(next() % uint64_t(high - low + 1));
+}
+
+string Workload::rational()
+{
+    int numerator = integer(-9, 9), denominator = integer(1, 4);
+    return (denominator == 1) ? to_string(numerator) : to_string(numerator) + "/" + to_string(denominator);
+}
+
+string Workload::integer_matrix(int rows, int cols)
+{
+    string text = "[";
+    for (int i = 0; i != rows; i++)
+    {
+        if (i != 0)
+            text += "; ";
+        for (int j = 0; j != cols; j++)
+            text += (j != 0 ? " " : "") + to_string(integer(-3, 3));
+    }
+    return text + "]";
+}
+
+string Workload::rational_matrix(int rows, int cols)
+{
+    string text = "[";
+    for (int i = 0; i != rows; i++)
+    {
+        if (i != 0)
+            text += "; ";
+        for (int j = 0; j != cols; j++)
+            text += (j != 0 ? " " : "") + rational();
+    }
+    return text + "]";
+}
+
+// Statements only read the inputs, so values do not grow with the script length
+string Workload::script(int statements, int size)
+{
+    const int inputs = 4;
+    string text;
+    for (int i = 0; i != inputs; i++)
+        text += "M" + to_string(i) + " = " + integer_matrix(size, size) + "\n";
+    text += "s = " + rational() + "\n";
+
+    for (int k = 0; k != statements; k++)
+    {
+        string a = "M" + to_string(integer(0, inputs - 1));
+        string b = "M" + to_string(integer(0, inputs - 1));
+        string c = "M" + to_string(integer(0, inputs - 1));
+        string target = "R" + to_string(k % 16);
+        switch (integer(0, 4))
+        {
+            case 0:
+                text += target + " = " + a + " * " + b + " + " + c + "\n";
+                break;
+            case 1:
+                text += target + " = s * " + a + " - T(" + b + ")\n";
+                break;
+            case 2:
+                text += target + " = " + a + " + " + b + " - " + c + "\n";
+                break;
+            case 3:
+                text += target + " = T(" + a + " * " + b + ")\n";
+                break;
+            default:
+                text += a + " - " + b + "\n";
+                break;
+        }
+    }
+    return text;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ==== Workload generator declaration ====
+
+// Deterministic source of benchmark inputs: the same seed gives the same numbers, matrix
+// literals and scripts on every platform, so results of different versions stay comparable.
+// Entries are kept small so that products of generated matrices do not overflow int.
+
+struct Workload
+{
+    explicit Workload(std::uint64_t seed);
+
+    int integer(int low, int high);
+    std::string rational();
+    std::string integer_matrix(int rows, int cols);
+    std::string rational_matrix(int rows, int cols);
+    // Inputs of size x size followed by statements that combine them and print some results
+    std::string script(int statements, int size);
+private:
+    std::uint64_t next();
+
+    std::uint64_t state;
+};
@@ -0,0 +1,88 @@
+#include <algorithm>
+#include "arena.hpp"
+#include "../types/var_types.hpp"
+
+using namespace std;
+
+const size_t Arena::CHUNK_SIZE = 4096;
+
+static thread_local Arena* active_arena = nullptr;
+
+static size_t align_up(size_t size)
+{
+    const size_t alignment = alignof(max_align_t);
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+Arena::Arena() :
+    chunks(vector<Chunk>()), current(0), offset(0), objects(vector<GenericValue*>())
+{}
+
+Arena::~Arena()
+{
+    reset();
+    for (Chunk& chunk : chunks)
+        ::operator delete(chunk.memory);
+}
+
+void Arena::add_chunk(size_t min_size)
+{
+    size_t size = max(CHUNK_SIZE, min_size);
+    chunks.push_back(Chunk{static_cast<char*>(::operator new(size)), size});
+}
+
+void* Arena::allocate(size_t size)
+{
+    size = align_up(size);
+    while (current < chunks.size() && offset + size > chunks[current].size)
+    {
+        current++;
+        offset = 0;
+    }
+    if (current == chunks.size())
+    {
+        add_chunk(size);
+        offset = 0;
+    }
+
+    void* pointer = chunks[current].memory + offset;
+    offset += size;
+    objects.push_back(static_cast<GenericValue*>(pointer));
+    return pointer;
+}
+
+void Arena::forget(void* pointer)
+{
+    auto found = find(objects.rbegin(), objects.rend(), static_cast<GenericValue*>(pointer));
+    if (found != objects.rend())
+        objects.erase(next(found).base());
+}
+
+bool Arena::owns(const void* pointer) const
+{
+    auto address = static_cast<const char*>(pointer);
+    return any_of(chunks.begin(), chunks.end(), [address](const Chunk& chunk)
+        { return address >= chunk.memory && address < chunk.memory + chunk.size; });
+}
+
+void Arena::reset()
+{
+    for (auto object = objects.rbegin(); object != objects.rend(); ++object)
+        (*object)->~GenericValue();
+    objects.clear();
+    current = 0;
+    offset = 0;
+}
+
+Arena* Arena::active() { return active_arena; }
+
+Arena::Scope::Scope(Arena* arena) :
+    previous(active_arena)
+{
+    active_arena = arena;
+}
+
+Arena::Scope::~Scope()
+{
+    active_arena = previous;
+}
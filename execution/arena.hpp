@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+struct GenericValue;
+
+// ==== Arena allocator declaration ====
+
+// Bump allocator owning every value created while one command is evaluated.
+// Value objects are routed here by GenericValue::operator new while a Scope is open,
+// so reset() only has to run their destructors and rewind the chunk pointer.
+
+struct Arena
+{
+    static const std::size_t CHUNK_SIZE;
+
+    Arena();
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(std::size_t size);
+    void forget(void* pointer);
+    bool owns(const void* pointer) const;
+    void reset();
+
+    static Arena* active();
+
+    struct Scope
+    {
+        explicit Scope(Arena* arena);
+        ~Scope();
+    private:
+        Arena* previous;
+    };
+private:
+    struct Chunk
+    {
+        char* memory;
+        std::size_t size;
+    };
+
+    void add_chunk(std::size_t min_size);
+
+    std::vector<Chunk> chunks;
+    std::size_t current;
+    std::size_t offset;
+    std::vector<GenericValue*> objects;
+};
@@ -1,10 +1,14 @@
 #include <iostream>
+#include "profiler.hpp"
+#include "tracer.hpp"
+#include "../types/matrix_io.hpp"
+#include "../types/value_pool.hpp"
 #include "../parsing/parser.hpp"
 
 using namespace std;
 
 Command::Command(bool correct, CommandCode c) :
-        correct(correct), c(c)
+        correct(correct), c(c), line_number(0)
 {}
 
 bool Command::run(Context* context)
@@ -12,20 +16,60 @@ bool Command::run(Context* context)
     return false;
 }
 
+bool Command::execute(Context* context)
+{
+    Tracer::Span span("statement", "statement");
+    if (span.recording())
+    {
+        span.set_name("line " + std::to_string(line_number));
+        span.add_argument("line", line_number);
+        span.add_argument("statement", to_string());
+    }
+    return run(context);
+}
+
+InvalidCommand::InvalidCommand(CommandCode c, string message) :
+        Command(false, c), message(std::move(message))
+{}
+
+bool InvalidCommand::run(Context* context)
+{
+    context->errors() << message << endl;
+    return false;
+}
+
 Assignment::Assignment(bool correct, string variable, Expression value) :
         Command(correct, ASSIGN), variable_name(std::move(variable)), value(std::move(value))
 {}
 
 bool Assignment::run(Context* context)
 {
+    if (context->is_lazy())
+        return context->define(variable_name, value);
     if (context->expression_to_TEMP(value))
     {
         context->copy_to(Context::TEMP_VAR, variable_name);
+        context->clear_TEMP();
         return true;
     }
     return false;
 }
 
+string Assignment::to_string() const
+{
+    return variable_name + " = " + value.to_string();
+}
+
+// A user function may read any variable, so a statement calling one runs alone
+bool Assignment::dependencies(vector<string>& reads, vector<string>& writes) const
+{
+    if (!value.function_names().empty())
+        return false;
+    reads = value.variable_names();
+    writes.assign(1, variable_name);
+    return true;
+}
+
 Output::Output(bool correct, Expression value) :
     Command(correct, OUTPUT), value(std::move(value))
 {}
@@ -35,12 +79,192 @@ bool Output::run(Context* context)
     if (context->expression_to_TEMP(value))
     {
         GenericValue* to_print = context->get_variable(Context::TEMP_VAR);
-        cout << to_print->to_string() << endl;
+        Tracer::Span span("output", "output");
+        if (span.recording() && to_print->get_type() == MATRIX)
+        {
+            span.add_argument("rows", static_cast<Matrix*>(to_print)->rows());
+            span.add_argument("cols", static_cast<Matrix*>(to_print)->cols());
+        }
+        if (context->is_summary() && to_print->get_type() == MATRIX)
+            static_cast<Matrix*>(to_print)->print_summary(context->output());
+        else
+            to_print->print(context->output());
+        context->output() << '\n';
+        context->clear_TEMP();
         return true;
     }
     else
     {
-        cerr << "Incorrect expression" << endl;
+        context->errors() << "Incorrect expression" << endl;
         return false;
     }
 }
+
+string Output::to_string() const
+{
+    return value.to_string();
+}
+
+bool Output::dependencies(vector<string>& reads, vector<string>& writes) const
+{
+    if (!value.function_names().empty())
+        return false;
+    reads = value.variable_names();
+    writes.clear();
+    return true;
+}
+
+AllocatorStats::AllocatorStats() :
+    Command(true, ALLOC_STATS)
+{}
+
+bool AllocatorStats::run(Context* context)
+{
+    ValuePool::Statistics stats = ValuePool::instance().statistics();
+    context->output() << "Live value objects: " << stats.live_objects << " (peak " << stats.peak_objects << ")" << endl;
+    context->output() << "Pool hits: " << stats.pool_hits << ", misses: " << stats.pool_misses
+         << ", hit rate: " << stats.hit_rate() * 100 << "%" << endl;
+    context->output() << "Large allocations: " << stats.large_allocations << endl;
+    return true;
+}
+
+ProfileStats::ProfileStats() :
+    Command(true, PROFILE_STATS)
+{}
+
+bool ProfileStats::run(Context* context)
+{
+    Profiler::print(context->output());
+    return true;
+}
+
+const size_t MemoryStats::LISTED_VARIABLES = 10;
+
+MemoryStats::MemoryStats() :
+    Command(true, MEMORY_STATS)
+{}
+
+bool MemoryStats::run(Context* context)
+{
+    Context::MemoryStatistics stats = context->memory_statistics();
+    context->output() << "Resident: " << stats.resident_bytes << " bytes";
+    if (context->get_memory_budget() != 0)
+        context->output() << " of " << context->get_memory_budget();
+    context->output() << ", on disk: " << stats.stored_bytes << " bytes" << endl;
+    context->output() << "Spilled: " << stats.spills << ", loaded back: " << stats.reloads << endl;
+    for (size_t i = 0; i != stats.variables.size() && i != LISTED_VARIABLES; i++)
+        context->output() << stats.variables[i].name << ": " << stats.variables[i].bytes << " bytes"
+            << (stats.variables[i].resident ? "" : " (on disk)") << endl;
+    return true;
+}
+
+CacheStats::CacheStats(bool clear) :
+    Command(true, CACHE_STATS), clear(clear)
+{}
+
+bool CacheStats::run(Context* context)
+{
+    ResultCache& cache = context->result_cache();
+    if (clear)
+    {
+        cache.clear();
+        context->output() << "Result cache cleared" << endl;
+        return true;
+    }
+    ResultCache::Statistics stats = cache.statistics();
+    context->output() << "Cache hits: " << stats.hits << ", misses: " << stats.misses
+         << ", evictions: " << stats.evictions << endl;
+    context->output() << "Cached results: " << stats.entries << " (" << stats.bytes << " of "
+         << cache.get_budget() << " bytes)" << endl;
+    return true;
+}
+
+WorkspaceCommand::WorkspaceCommand(CommandCode c, string path) :
+    Command(true, c), path(std::move(path))
+{}
+
+bool WorkspaceCommand::run(Context* context)
+{
+    if (c == SAVE ? context->save_workspace(path) : context->load_workspace(path))
+        return true;
+    context->errors() << "Error with " << (c == SAVE ? "saving workspace to " : "loading workspace from ")
+                      << path << endl;
+    return false;
+}
+
+string WorkspaceCommand::to_string() const
+{
+    return string(c == SAVE ? "save" : "load") + " \"" + path + "\"";
+}
+
+Export::Export(bool binary, Expression value, string path) :
+    Command(true, EXPORT), binary(binary), value(std::move(value)), path(std::move(path))
+{}
+
+bool Export::run(Context* context)
+{
+    if (!context->expression_to_TEMP(value))
+    {
+        context->errors() << "Incorrect expression" << endl;
+        return false;
+    }
+    GenericValue* result = context->get_variable(Context::TEMP_VAR);
+    bool written = context->release_file(path) && (binary ? write_bin(result, path) : write_csv(result, path));
+    context->clear_TEMP();
+    if (!written)
+        context->errors() << "Error with writing to " << path << endl;
+    return written;
+}
+
+string Export::to_string() const
+{
+    return string(binary ? "write_bin(" : "write_csv(") + value.to_string() + ", \"" + path + "\")";
+}
+
+Repeat::Repeat(int count, vector<Command*> body) :
+    Command(true, REPEAT), count(count), body(std::move(body))
+{}
+
+Repeat::~Repeat()
+{
+    for (Command* command : body)
+        delete command;
+}
+
+bool Repeat::run(Context* context)
+{
+    // A repeat block runs alone, so the memory budget can be enforced between its commands
+    // and its statements can read variables through slots
+    Context::Slots slots(context);
+    for (int i = 0; i != count; i++)
+        for (Command* command : body)
+        {
+            if (!command->execute(context))
+                return false;
+            context->enforce_budget();
+        }
+    return true;
+}
+
+string Repeat::to_string() const
+{
+    string text = "repeat " + std::to_string(count) + " {";
+    for (size_t i = 0; i != body.size(); i++)
+        text += (i != 0 ? "; " : " ") + body[i]->to_string();
+    return text + " }";
+}
+
+FunctionDefinition::FunctionDefinition(string name, string parameter, Expression body) :
+    Command(true, DEFINE), name(std::move(name)), parameter(std::move(parameter)), body(std::move(body))
+{}
+
+bool FunctionDefinition::run(Context* context)
+{
+    context->define_function(name, body);
+    return true;
+}
+
+string FunctionDefinition::to_string() const
+{
+    return "def " + name + "(" + parameter + ") = " + body.to_string();
+}
@@ -7,6 +7,15 @@ enum CommandCode
     EXIT,
     ASSIGN,
     OUTPUT,
+    ALLOC_STATS,
+    CACHE_STATS,
+    SAVE,
+    LOAD,
+    EXPORT,
+    PROFILE_STATS,
+    REPEAT,
+    DEFINE,
+    MEMORY_STATS,
 };
 
 // ==== Command base class declaration ====
@@ -14,12 +23,35 @@ enum CommandCode
 struct Command
 {
     Command(bool correct, CommandCode c);
+    virtual ~Command() = default;
     virtual bool run(Context* context);
+    // run() inside a trace span of the statement
+    bool execute(Context* context);
+    virtual std::string to_string() const { return std::string(); }
+    // Variables the command reads and writes; false if it has other effects and must run alone
+    virtual bool dependencies(std::vector<std::string>& /*reads*/, std::vector<std::string>& /*writes*/) const
+    { return false; }
     inline bool is_correct() const { return correct; }
     inline CommandCode code() const { return c; }
+    inline void set_line(int line) { line_number = line; }
+    inline int line() const { return line_number; }
 protected:
     bool correct;
     CommandCode c;
+    int line_number;
+};
+
+// ==== Invalid command class declaration ====
+
+// Result of a line that failed to parse; running it reports the syntax error,
+// so the message appears in order with the output of earlier commands
+
+struct InvalidCommand : Command
+{
+    InvalidCommand(CommandCode c, std::string message);
+    bool run(Context* context) override;
+private:
+    std::string message;
 };
 
 // ==== Assignment command class declaration ====
@@ -28,6 +60,8 @@ struct Assignment : Command
 {
     Assignment(bool correct, std::string variable, Expression value);
     bool run(Context* context) override;
+    std::string to_string() const override;
+    bool dependencies(std::vector<std::string>& reads, std::vector<std::string>& writes) const override;
 private:
     std::string variable_name;
     Expression value;
@@ -39,6 +73,106 @@ struct Output : Command
 {
     Output(bool correct, Expression value);
     bool run(Context* context) override;
+    std::string to_string() const override;
+    bool dependencies(std::vector<std::string>& reads, std::vector<std::string>& writes) const override;
+private:
+    Expression value;
+};
+
+// ==== Allocator statistics command class declaration ====
+
+struct AllocatorStats : Command
+{
+    AllocatorStats();
+    bool run(Context* context) override;
+};
+
+// ==== Profiling statistics command class declaration ====
+
+struct ProfileStats : Command
+{
+    ProfileStats();
+    bool run(Context* context) override;
+};
+
+// ==== Memory usage command class declaration ====
+
+// :mem prints the bytes held in memory against the budget and the largest variables
+
+struct MemoryStats : Command
+{
+    static const std::size_t LISTED_VARIABLES;
+
+    MemoryStats();
+    bool run(Context* context) override;
+};
+
+// ==== Result cache command class declaration ====
+
+struct CacheStats : Command
+{
+    explicit CacheStats(bool clear);
+    bool run(Context* context) override;
+private:
+    bool clear;
+};
+
+// ==== Workspace snapshot command class declaration ====
+
+// save "path" writes every variable to a snapshot file, load "path" brings them back
+
+struct WorkspaceCommand : Command
+{
+    WorkspaceCommand(CommandCode c, std::string path);
+    bool run(Context* context) override;
+    std::string to_string() const override;
+private:
+    std::string path;
+};
+
+// ==== Export command class declaration ====
+
+// write_csv(expression, "path") and write_bin(expression, "path") store the value in a file
+// read_csv or read_bin can load again
+
+struct Export : Command
+{
+    Export(bool binary, Expression value, std::string path);
+    bool run(Context* context) override;
+    std::string to_string() const override;
 private:
+    bool binary;
     Expression value;
-};
\ No newline at end of file
+    std::string path;
+};
+
+// ==== Repeat block class declaration ====
+
+// repeat N { ... } runs the statements of its body N times. They are parsed once with the
+// block, so an iteration only evaluates them.
+
+struct Repeat : Command
+{
+    Repeat(int count, std::vector<Command*> body);
+    ~Repeat() override;
+    bool run(Context* context) override;
+    std::string to_string() const override;
+private:
+    int count;
+    std::vector<Command*> body;
+};
+
+// ==== Function definition class declaration ====
+
+// def f(X) = expression defines a function of one argument called as f(expression)
+
+struct FunctionDefinition : Command
+{
+    FunctionDefinition(std::string name, std::string parameter, Expression body);
+    bool run(Context* context) override;
+    std::string to_string() const override;
+private:
+    std::string name;
+    std::string parameter;
+    Expression body;
+};
@@ -1,142 +1,871 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
 #include "../execution/context.hpp"
+#include "../execution/profiler.hpp"
+#include "../execution/tracer.hpp"
+#include "../types/matrix_io.hpp"
 
 using namespace std;
 
 string const Context::TEMP_VAR = "TEMP";
+const size_t Context::MAX_CALL_DEPTH = 64;
 
-Context::Context() :
-    variables(unordered_map<string, GenericValue*>()),
-    unary_functions(unordered_map<string, bool (*)(GenericValue*, GenericValue**)>())
+// Evaluation state of the command running on this thread, replaced during an Isolation
+struct Frame
 {
-    unary_functions.emplace("T", T);
-    unary_functions.emplace("-", unary_minus);
-}
+    Arena temporaries;
+    GenericValue* temp = nullptr;
+    vector<shared_ptr<GenericValue>> pinned;
+    // Arguments of the user function calls being evaluated, innermost last
+    vector<GenericValue*> arguments;
+    Context::Slots* slots = nullptr;
+    ostream* output = nullptr;
+    ostream* errors = nullptr;
+};
+
+static thread_local Frame thread_frame;
+static thread_local Frame* frame = &thread_frame;
+
+Context::Context() :
+    variables(unordered_map<string, shared_ptr<GenericValue>>()),
+    stored(unordered_map<string, pair<shared_ptr<Snapshot>, size_t>>()),
+    functions(unordered_map<string, Expression>()),
+    results(ResultCache::DEFAULT_BUDGET),
+    versions(unordered_map<string, unsigned long>()), last_version(0), layout(0),
+    memory_budget(0), resident_bytes(0), spills(0), reloads(0),
+    last_use(unordered_map<string, unsigned long>()), use_clock(0), lazy(false), summary(false),
+    formulas(unordered_map<string, Expression>()),
+    dependents(unordered_map<string, unordered_set<string>>())
+{}
 
 Context::~Context()
 {
-    for_each(variables.begin(), variables.end(),
-             [](const pair<string, GenericValue*>& element) { delete element.second; });
+    clear_TEMP();
 }
 
 void Context::update_variable(const string& var_name, GenericValue* value)
 {
-    if (has_variable(var_name))
+    update_variable(var_name, shared_ptr<GenericValue>(value));
+}
+
+void Context::update_variable(const string& var_name, shared_ptr<GenericValue> value)
+{
     {
-        delete variables.at(var_name);
-        variables.erase(var_name);
+        unique_lock<shared_mutex> guard(variables_lock);
+        versions[var_name] = ++last_version;
+        stored.erase(var_name);
+        resident_bytes += value->byte_size();
+        auto found = variables.find(var_name);
+        if (found != variables.end())
+        {
+            resident_bytes -= found->second->byte_size();
+            found->second = std::move(value);
+        }
+        else
+        {
+            variables.emplace(var_name, std::move(value));
+            layout++;
+        }
     }
-    variables.emplace(var_name, value);
+    touch(var_name);
 }
 
-bool Context::expression_to_TEMP(Expression expression)
+void Context::erase_variable(const string& var_name)
 {
-    if (expression.get_type() == VARIABLE)
+    unique_lock<shared_mutex> guard(variables_lock);
+    stored.erase(var_name);
+    auto found = variables.find(var_name);
+    if (found != variables.end())
     {
-        if (!has_variable(expression[0].get_value()))
-            return false;
-        copy_to(expression[0].get_value(), TEMP_VAR);
-        return true;
+        resident_bytes -= found->second->byte_size();
+        variables.erase(found);
+        layout++;
     }
-    else if (expression.get_type() == VALUE)
+    lock_guard<mutex> usage(usage_lock);
+    last_use.erase(var_name);
+}
+
+bool Context::has_variable(const string& var_name)
+{
+    shared_lock<shared_mutex> guard(variables_lock);
+    return variables.find(var_name) != variables.end() || stored.find(var_name) != stored.end();
+}
+
+// Values stay valid after the lock is released: a command never runs concurrently
+// with one that reassigns a variable it reads
+GenericValue* Context::get_variable(const string& var_name)
+{
+    if (var_name == TEMP_VAR)
+        return frame->temp;
     {
-        if (expression[0].get_type() == TOKEN_RATIONAL)
+        shared_lock<shared_mutex> guard(variables_lock);
+        auto found = variables.find(var_name);
+        if (found != variables.end())
         {
-            GenericValue* value = new RationalNumber(expression[0].get_value());
-            update_variable(TEMP_VAR, value);
-            return true;
-        }
-        else if (expression[0].get_type() == TOKEN_MATRIX)
-        {
-            GenericValue* value = new Matrix(expression[0].get_value());
-            update_variable(TEMP_VAR, value);
-            return true;
+            touch(var_name);
+            return found->second.get();
         }
-        else
+        if (stored.find(var_name) == stored.end())
+            return nullptr;
+    }
+    GenericValue* value = materialize(var_name);
+    if (value != nullptr)
+        touch(var_name);
+    return value;
+}
+
+// Builds a loaded variable from its snapshot; another thread may have done it in the meantime
+GenericValue* Context::materialize(const string& var_name)
+{
+    unique_lock<shared_mutex> guard(variables_lock);
+    auto found = variables.find(var_name);
+    if (found != variables.end())
+        return found->second.get();
+    auto entry = stored.find(var_name);
+    if (entry == stored.end())
+        return nullptr;
+
+    Arena::Scope heap(nullptr);
+    GenericValue* value = entry->second.first->materialize(entry->second.second);
+    stored.erase(entry);
+    if (value != nullptr)
+    {
+        variables.emplace(var_name, shared_ptr<GenericValue>(value));
+        layout++;
+        resident_bytes += value->byte_size();
+        reloads++;
+    }
+    return value;
+}
+
+bool Context::save_workspace(const string& path)
+{
+    // In lazy mode assignments are formulas until something reads them, so the ones
+    // not evaluated yet are evaluated now; a formula that cannot be evaluated fails the save
+    vector<string> pending;
+    for (const auto& formula : formulas)
+        pending.push_back(formula.first);
+    for (const string& name : pending)
+        if (!resolve(name))
             return false;
+
+    vector<string> names;
+    {
+        shared_lock<shared_mutex> guard(variables_lock);
+        for (const auto& variable : variables)
+            names.push_back(variable.first);
+        for (const auto& entry : stored)
+            names.push_back(entry.first);
     }
-    else if (expression.get_type() == UNARY)
+    sort(names.begin(), names.end());
+
+    vector<pair<string, GenericValue*>> values;
+    for (const string& name : names)
     {
-        string function_name = expression[0].get_value();
-        if (!has_unary_function(function_name))
+        GenericValue* value = get_variable(name);
+        if (value == nullptr)
             return false;
+        values.emplace_back(name, value);
+    }
+    return release_file(path) && Snapshot::save(path, values);
+}
+
+// Truncating a mapped file would make reading the rest of the mapping fault
+bool Context::release_file(const string& path)
+{
+    vector<string> names;
+    {
+        shared_lock<shared_mutex> guard(variables_lock);
+        for (const auto& entry : stored)
+            if (entry.second.first->maps(path))
+                names.push_back(entry.first);
+    }
+    for (const string& name : names)
+        if (materialize(name) == nullptr)
+            return false;
+    return true;
+}
+
+// Loaded variables replace current values and formulas of the same name
+bool Context::load_workspace(const string& path)
+{
+    shared_ptr<Snapshot> snapshot = Snapshot::open(path);
+    if (snapshot == nullptr)
+        return false;
+    const vector<Snapshot::Entry>& entries = snapshot->entries();
+    for (size_t i = 0; i != entries.size(); i++)
+    {
+        forget_formula(entries[i].name);
+        erase_variable(entries[i].name);
+        invalidate_dependents(entries[i].name);
 
-        GenericValue* object_copy;
-        auto result = new GenericValue*();
+        unique_lock<shared_mutex> guard(variables_lock);
+        versions[entries[i].name] = ++last_version;
+        stored[entries[i].name] = make_pair(snapshot, i);
+    }
+    return true;
+}
+
+ostream& Context::output()
+{
+    return (frame->output != nullptr) ? *frame->output : cout;
+}
+
+ostream& Context::errors()
+{
+    return (frame->errors != nullptr) ? *frame->errors : cerr;
+}
 
-        if (expression[1].get_type() == TOKEN_VARIABLE)
+Context::Redirect::Redirect(ostream* output, ostream* errors) :
+    previous_output(frame->output), previous_errors(frame->errors)
+{
+    frame->output = output;
+    frame->errors = errors;
+}
+
+Context::Redirect::~Redirect()
+{
+    frame->output = previous_output;
+    frame->errors = previous_errors;
+}
+
+Context::Slots::Slots(Context* context) :
+    context(context), previous(frame->slots), active(!context->lazy), names(vector<string>()),
+    entries(vector<shared_ptr<GenericValue>*>()), layout(0),
+    bound(unordered_map<const Expression*, Expression>())
+{
+    if (active)
+        frame->slots = this;
+}
+
+Context::Slots::~Slots()
+{
+    if (active)
+        frame->slots = previous;
+}
+
+// The copy gives every variable token the index of its name, so reads skip the name lookup
+const Expression& Context::Slots::bind(const Expression& expression)
+{
+    auto found = bound.find(&expression);
+    if (found != bound.end())
+        return found->second;
+    vector<Token> parts = expression.tokens();
+    for (Token& token : parts)
+    {
+        if (token.get_type() != TOKEN_VARIABLE)
+            continue;
+        auto name = find(names.begin(), names.end(), token.get_value());
+        if (name == names.end())
+            name = names.insert(names.end(), token.get_value());
+        token = token.with_slot(int(name - names.begin()));
+    }
+    return bound.emplace(&expression, Expression(expression.is_correct(), expression.get_type(), parts))
+        .first->second;
+}
+
+// Entries stay valid while the map only gains and loses other names; when it has changed
+// since the last read all of them are looked up again, loading stored variables as usual
+GenericValue* Context::Slots::read(int slot)
+{
+    if (entries.size() != names.size() || layout != context->layout)
+    {
+        for (const string& name : names)
+            context->get_variable(name);
+        shared_lock<shared_mutex> guard(context->variables_lock);
+        entries.clear();
+        for (const string& name : names)
         {
-            if (!has_variable(expression[1].get_value()))
-                return false;
-            object_copy = variables.at(expression[1].get_value())->clone();
+            auto found = context->variables.find(name);
+            entries.push_back(found != context->variables.end() ? &found->second : nullptr);
         }
-        else if (expression[1].get_type() == TOKEN_RATIONAL)
-            object_copy = new RationalNumber(expression[1].get_value());
-        else if (expression[1].get_type() == TOKEN_MATRIX)
-            object_copy = new Matrix(expression[1].get_value());
-        else
+        layout = context->layout;
+    }
+    if (context->memory_budget != 0)
+        context->touch(names[slot]);
+    return entries[slot] != nullptr ? entries[slot]->get() : nullptr;
+}
+
+Context::Isolation::Isolation() :
+    previous(frame), own(new Frame()), heap(nullptr)
+{
+    frame = own;
+}
+
+Context::Isolation::~Isolation()
+{
+    frame = previous;
+    delete own;
+}
+
+// Operands are borrowed from variables or from the constants built by the parser,
+// so nothing evaluated here has to be freed on the failure paths.
+GenericValue* Context::operand(const Token& token)
+{
+    switch (token.get_type())
+    {
+        case TOKEN_VARIABLE:
+            if (token.get_slot() >= 0)
+                return frame->slots->read(token.get_slot());
+            return get_variable(token.get_value());
+        case TOKEN_RATIONAL:
+        case TOKEN_MATRIX:
+            return token.get_constant();
+        case TOKEN_PARAMETER:
+            return frame->arguments.empty() ? nullptr : frame->arguments.back();
+        default:
+            return nullptr;
+    }
+}
+
+// Functions cannot branch, so a recursive one never ends; the depth limit turns it into an error
+bool Context::call(const Expression& body, GenericValue* argument, GenericValue** result)
+{
+    if (frame->arguments.size() == MAX_CALL_DEPTH)
+        return false;
+    frame->arguments.push_back(argument);
+    int position = 0;
+    bool succeeded = evaluate(body, position, result);
+    frame->arguments.pop_back();
+    return succeeded;
+}
+
+void Context::define_function(const string& name, const Expression& body)
+{
+    auto readers = dependents.find(name + "()");
+    if (readers == dependents.end())
+    {
+        functions.insert_or_assign(name, body);
+        return;
+    }
+    // Formulas calling the function now read what the new body reads instead of the old one
+    unordered_set<string> formula_names = readers->second;
+    for (const string& reader : formula_names)
+    {
+        auto formula = formulas.find(reader);
+        if (formula != formulas.end())
+            for (const string& input : inputs_of(formula->second, true))
+                dependents[input].erase(reader);
+    }
+    functions.insert_or_assign(name, body);
+    for (const string& reader : formula_names)
+    {
+        auto formula = formulas.find(reader);
+        if (formula != formulas.end())
+            for (const string& input : inputs_of(formula->second, true))
+                dependents[input].insert(reader);
+    }
+    invalidate_dependents(name + "()");
+}
+
+bool Context::expression_to_TEMP(const Expression& expression)
+{
+    PROFILE_SCOPE(PROFILE_EVALUATE);
+    PROFILE_COUNT(PROFILE_EVALUATE, expression.size(), 0, 0);
+    Tracer::Span span("evaluate", "evaluate");
+    clear_TEMP();
+    if (!expression.is_correct() || expression.size() == 0)
+        return false;
+    if (lazy)
+        for (const string& name : inputs_of(expression, false))
+            if (!resolve(name))
+                return false;
+
+    Arena::Scope scope(&frame->temporaries);
+    int position = 0;
+    GenericValue* result = nullptr;
+    if (!evaluate(frame->slots != nullptr ? frame->slots->bind(expression) : expression, position, &result))
+        return false;
+    frame->temp = result;
+    return true;
+}
+
+// Evaluates the subexpression starting at position and moves position past it
+bool Context::evaluate(const Expression& expression, int& position, GenericValue** result)
+{
+    int start = position;
+    const Token& token = expression[position++];
+    string key;
+    if (token.get_type() == TOKEN_UNARY || token.get_type() == TOKEN_CALL)
+    {
+        const Kernel* kernel = KernelRegistry::shared().find(token.get_value(), size_t(token.get_arity()));
+        if (kernel != nullptr)
+            return apply_kernel(*kernel, expression, --position, result);
+        auto function = functions.find(token.get_value());
+        GenericValue* argument = nullptr;
+        return token.get_type() == TOKEN_UNARY && function != functions.end()
+            && evaluate(expression, position, &argument) && call(function->second, argument, result);
+    }
+    else if (token.get_type() == TOKEN_BINARY)
+    {
+        if (is_fusable(expression, start))
+            return evaluate_fused(expression, --position, result);
+
+        GenericValue* left = nullptr, *right = nullptr;
+        if (!evaluate(expression, position, &left) || !evaluate(expression, position, &right))
             return false;
+        bool has_matrix = left->get_type() == MATRIX || right->get_type() == MATRIX;
+        if (cached_result(expression, start, position, has_matrix, key, result))
+            return true;
+        return binary_operation(token.get_value(), left, right, result) && store_result(key, result);
+    }
+    else if (token.get_type() == TOKEN_IMPORT)
+        return import_matrix(token.get_value(), result);
+    *result = operand(token);
+    return *result != nullptr;
+}
 
-        if (!unary_functions.at(function_name)(object_copy, result))
+// Evaluates the call starting at position. The arguments are checked against the kernel's
+// parameter types before it runs; an in-place kernel updates its first argument when no one
+// else can see it and a copy otherwise.
+bool Context::apply_kernel(const Kernel& kernel, const Expression& expression, int& position, GenericValue** result)
+{
+    int start = position++;
+    GenericValue* arguments[Kernel::MAX_ARITY];
+    int first = position;
+    bool has_matrix = false;
+    for (size_t i = 0; i != kernel.parameters.size(); i++)
+    {
+        if (!evaluate(expression, position, &arguments[i]))
             return false;
-        update_variable(TEMP_VAR, *result);
-        delete object_copy; delete result;
+        has_matrix = has_matrix || arguments[i]->get_type() == MATRIX;
+    }
+    if (!kernel.accepts(arguments))
+        return false;
+    string key;
+    if (cached_result(expression, start, position, has_matrix, key, result))
         return true;
+    if (kernel.in_place == nullptr)
+        return kernel.function(arguments, result) && store_result(key, result);
+
+    auto target = static_cast<Matrix*>(arguments[0]);
+    if (!is_writable(expression, first, target))
+        target = new Matrix(*target);
+    if (!kernel.in_place(*target, arguments + 1))
+        return false;
+    *result = target;
+    return store_result(key, result);
+}
+
+// A value computed by the subexpression at position belongs to the caller alone when it is an
+// arena temporary made by an operator, a kernel or an import. Variables, literals and cached
+// results are shared, and a user function may return its argument, which it reads elsewhere.
+bool Context::is_writable(const Expression& expression, int position, GenericValue* value)
+{
+    const Token& token = expression[position];
+    bool computed = token.get_type() == TOKEN_BINARY || token.get_type() == TOKEN_IMPORT
+        || ((token.get_type() == TOKEN_UNARY || token.get_type() == TOKEN_CALL)
+            && KernelRegistry::shared().find(token.get_value(), size_t(token.get_arity())) != nullptr);
+    return computed && frame->temporaries.owns(value);
+}
+
+inline bool is_product(const Token& token)
+{
+    return token.get_type() == TOKEN_BINARY && token.get_value() == "*";
+}
+
+// Products and sums or differences with a product operand are evaluated by the fused kernels
+bool Context::is_fusable(const Expression& expression, int position)
+{
+    const string& op = expression[position].get_value();
+    if (op == "*")
+        return true;
+    if (op != "+" && op != "-")
+        return false;
+    return is_product(expression[position + 1])
+        || is_product(expression[expression.subexpression_end(position + 1)]);
+}
+
+// Flattens a chain of multiplications: scalar factors (and unary minuses) are gathered into scale,
+// matrix factors are kept in order
+bool Context::evaluate_product(const Expression& expression, int& position,
+                               RationalNumber& scale, vector<GenericValue*>& matrices)
+{
+    const Token& token = expression[position];
+    if (is_product(token))
+    {
+        position++;
+        return evaluate_product(expression, position, scale, matrices)
+            && evaluate_product(expression, position, scale, matrices);
+    }
+    else if (token.get_type() == TOKEN_UNARY && token.get_value() == "-")
+    {
+        position++;
+        scale = -scale;
+        return evaluate_product(expression, position, scale, matrices);
+    }
+
+    GenericValue* factor = nullptr;
+    if (!evaluate(expression, position, &factor))
+        return false;
+    if (factor->get_type() == RATIONAL_NUMBER)
+        scale = scale * *dynamic_cast<RationalNumber*>(factor);
+    else
+        matrices.push_back(factor);
+    return true;
+}
+
+// Evaluates alpha * M1 * ... * Mn + beta * addend so that the last multiplication, the scaling
+// and the addition happen in one kernel writing a single result
+bool Context::evaluate_fused(const Expression& expression, int& position, GenericValue** result)
+{
+    int start = position;
+    char op = expression[position].get_value()[0];
+    RationalNumber alpha(1, 1), beta(1, 1);
+    vector<GenericValue*> matrices;
+    GenericValue* addend = nullptr;
+
+    if (op == '*')
+    {
+        if (!evaluate_product(expression, position, alpha, matrices))
+            return false;
     }
-    else if (expression.get_type() == BINARY)
+    else if (is_product(expression[++position]))
     {
-        GenericValue* left, *right;
-        if (expression[1].get_type() == TOKEN_VARIABLE)
+        if (!evaluate_product(expression, position, alpha, matrices) || !evaluate(expression, position, &addend))
+            return false;
+        beta = RationalNumber(op == '-' ? -1 : 1, 1);
+    }
+    else
+    {
+        if (!evaluate(expression, position, &addend) || !evaluate_product(expression, position, alpha, matrices))
+            return false;
+        if (op == '-')
+            alpha = -alpha;
+    }
+
+    string key;
+    bool has_matrix = !matrices.empty() || (addend != nullptr && addend->get_type() == MATRIX);
+    if (cached_result(expression, start, position, has_matrix, key, result))
+        return true;
+    return apply_fused(alpha, matrices, beta, addend, result) && store_result(key, result);
+}
+
+bool Context::apply_fused(const RationalNumber& alpha, vector<GenericValue*>& matrices,
+                          const RationalNumber& beta, GenericValue* addend, GenericValue** result)
+{
+    while (matrices.size() > 2)
+    {
+        GenericValue* partial = nullptr;
+        if (!multiply(matrices[0], matrices[1], &partial))
+            return false;
+        matrices.erase(matrices.begin());
+        matrices[0] = partial;
+    }
+
+    if (matrices.empty())
+    {
+        if (addend == nullptr)
         {
-            if (!has_variable(expression[1].get_value()))
-                return false;
-            left = variables.at(expression[1].get_value())->clone();
+            *result = new RationalNumber(alpha);
+            return true;
+        }
+        if (addend->get_type() != RATIONAL_NUMBER)
+            return false;
+        *result = new RationalNumber(alpha + beta * *dynamic_cast<RationalNumber*>(addend));
+        return true;
+    }
+    else if (matrices.size() == 1)
+        return scaled_add(alpha, matrices[0], beta, addend, result);
+    else
+        return multiply_add(alpha, matrices[0], matrices[1], beta, addend, result);
+}
+
+void Context::clear_TEMP()
+{
+    frame->temp = nullptr;
+    frame->temporaries.reset();
+    frame->pinned.clear();
+}
+
+// ==== Operation result caching ====
+
+unsigned long Context::version_of(const string& var_name)
+{
+    shared_lock<shared_mutex> guard(variables_lock);
+    auto found = versions.find(var_name);
+    return (found != versions.end()) ? found->second : 0;
+}
+
+// Operands are identified by variable versions and literal ids, operators by their text.
+// A literal id names one parsed value for as long as the token exists, so equal keys mean
+// equal operands and the key does not grow with the size of the literal.
+// Files may change between reads, so operations on imported values get no key. Neither do
+// user function calls, whose bodies read variables the key does not list, and parameters.
+string Context::cache_key(const Expression& expression, int start, int end)
+{
+    string key;
+    for (int i = start; i != end; i++)
+    {
+        const Token& token = expression[i];
+        if (token.get_type() == TOKEN_IMPORT || token.get_type() == TOKEN_PARAMETER)
+            return string();
+        if (token.get_type() == TOKEN_UNARY && !has_unary_function(token.get_value()))
+            return string();
+        if (token.get_type() == TOKEN_VARIABLE)
+            key += token.get_value() + "@" + to_string(version_of(token.get_value()));
+        else if (token.get_constant() != nullptr)
+            key += "#" + to_string(token.get_constant_id());
+        else
+            key += token.get_value();
+        key += ' ';
+    }
+    return key;
+}
+
+// Only operations on matrices are worth caching. On a miss the key is left for store_result.
+bool Context::cached_result(const Expression& expression, int start, int end, bool has_matrix_operand,
+                            string& key, GenericValue** result)
+{
+    if (!results.enabled() || !has_matrix_operand || frame->slots != nullptr)
+        return false;
+    key = cache_key(expression, start, end);
+    if (key.empty())
+        return false;
+    shared_ptr<GenericValue> cached = results.find(key);
+    if (cached == nullptr)
+        return false;
+    *result = cached.get();
+    frame->pinned.push_back(std::move(cached));
+    return true;
+}
+
+// Moves a freshly computed result out of the arena into the cache, which shares it with the
+// variable it may be assigned to
+bool Context::store_result(const string& key, GenericValue** result)
+{
+    if (key.empty())
+        return true;
+    Arena::Scope heap(nullptr);
+    shared_ptr<GenericValue> stored = results.insert(key, (*result)->move_clone());
+    *result = stored.get();
+    frame->pinned.push_back(std::move(stored));
+    return true;
+}
+
+// Only the value promoted out of TEMP outlives the command: arena results are moved
+// into a heap object, cached results are shared, borrowed variables are copied.
+void Context::copy_to(const string& from_var, const string& to_var)
+{
+    GenericValue* source = get_variable(from_var);
+    for (const shared_ptr<GenericValue>& cached : frame->pinned)
+        if (cached.get() == source)
+        {
+            update_variable(to_var, cached);
+            return;
         }
-        else if (expression[1].get_type() == TOKEN_RATIONAL)
-            left = new RationalNumber(expression[1].get_value());
-        else if (expression[1].get_type() == TOKEN_MATRIX)
-            left = new Matrix(expression[1].get_value());
+    if (frame->temporaries.owns(source))
+        update_variable(to_var, source->move_clone());
+    else
+        update_variable(to_var, source->clone());
+}
 
-        if (expression[2].get_type() == TOKEN_VARIABLE)
+// ==== Memory accounting ====
+
+// Only kept while there is a budget, so reads cost nothing extra otherwise
+void Context::touch(const string& var_name)
+{
+    if (memory_budget == 0)
+        return;
+    lock_guard<mutex> usage(usage_lock);
+    last_use[var_name] = ++use_clock;
+}
+
+string Context::spill_path()
+{
+    auto stamp = chrono::steady_clock::now().time_since_epoch().count();
+    string name = "math_interpreter_spill_" + to_string(reinterpret_cast<uintptr_t>(this)) + "_"
+        + to_string(stamp) + "_" + to_string(spills) + ".bin";
+    return (filesystem::temp_directory_path() / name).string();
+}
+
+// Matrices bound from caller memory stay, since their elements are not counted anyway.
+// The spilled values are written to one snapshot, which is removed once none of them is stored
+// in it any more: each one is either read back or replaced.
+void Context::enforce_budget()
+{
+    if (memory_budget == 0)
+        return;
+    vector<pair<string, GenericValue*>> victims;
+    {
+        shared_lock<shared_mutex> guard(variables_lock);
+        if (resident_bytes <= memory_budget)
+            return;
+        vector<pair<unsigned long, string>> candidates;
         {
-            if (!has_variable(expression[2].get_value()))
-                return false;
-            right = variables.at(expression[2].get_value())->clone();
+            lock_guard<mutex> usage(usage_lock);
+            for (const auto& variable : variables)
+                if (variable.second->get_type() == MATRIX && !static_cast<Matrix*>(variable.second.get())->is_view())
+                {
+                    auto used = last_use.find(variable.first);
+                    candidates.emplace_back(used != last_use.end() ? used->second : 0, variable.first);
+                }
         }
-        else if (expression[2].get_type() == TOKEN_RATIONAL)
-            right = new RationalNumber(expression[2].get_value());
-        else if (expression[2].get_type() == TOKEN_MATRIX)
-            right = new Matrix(expression[2].get_value());
-
-        auto result = new GenericValue*();
-        *result = nullptr;
-        switch (expression[0].get_value()[0])
+        sort(candidates.begin(), candidates.end());
+        size_t bytes = resident_bytes;
+        for (const auto& candidate : candidates)
         {
-            case '+':
-                if (!add(left, right, result))
-                    return false;
-                break;
-            case '-':
-                if (!subtract(left, right, result))
-                    return false;
-                break;
-            case '*':
-                if (!multiply(left, right, result))
-                    return false;
-                break;
-            case '/':
-                if (!divide(left, right, result))
-                    return false;
+            if (bytes <= memory_budget)
                 break;
+            GenericValue* value = variables.at(candidate.second).get();
+            bytes -= value->byte_size();
+            victims.emplace_back(candidate.second, value);
         }
-        update_variable(TEMP_VAR, *result);
-        delete left; delete right; delete result;
-        return true;
     }
-    else
+    if (victims.empty())
+        return;
+
+    string path = spill_path();
+    shared_ptr<Snapshot> snapshot;
+    if (!Snapshot::save(path, victims) || (snapshot = Snapshot::open_temporary(path)) == nullptr)
+    {
+        errors() << "Error with spilling variables to " << path << endl;
+        return;
+    }
+    unique_lock<shared_mutex> guard(variables_lock);
+    for (size_t i = 0; i != victims.size(); i++)
+    {
+        auto found = variables.find(victims[i].first);
+        if (found == variables.end() || found->second.get() != victims[i].second)
+            continue;
+        resident_bytes -= found->second->byte_size();
+        variables.erase(found);
+        layout++;
+        stored[victims[i].first] = make_pair(snapshot, i);
+        spills++;
+    }
+}
+
+Context::MemoryStatistics Context::memory_statistics()
+{
+    shared_lock<shared_mutex> guard(variables_lock);
+    MemoryStatistics statistics = {resident_bytes, 0, spills, reloads, vector<MemoryUsage>()};
+    for (const auto& variable : variables)
+        statistics.variables.push_back({variable.first, variable.second->byte_size(), true});
+    for (const auto& entry : stored)
+    {
+        const Snapshot::Entry& stored_entry = entry.second.first->entries()[entry.second.second];
+        size_t bytes = stored_entry.type == MATRIX ? Matrix::byte_size(stored_entry.rows, stored_entry.cols)
+                                                   : sizeof(RationalNumber);
+        statistics.stored_bytes += bytes;
+        statistics.variables.push_back({entry.first, bytes, false});
+    }
+    sort(statistics.variables.begin(), statistics.variables.end(),
+         [](const MemoryUsage& left, const MemoryUsage& right)
+         { return left.bytes != right.bytes ? left.bytes > right.bytes : left.name < right.name; });
+    return statistics;
+}
+
+// ==== Lazy dataflow evaluation ====
+
+bool Context::depends_on(const string& var_name, const string& input)
+{
+    if (var_name == input)
+        return true;
+    auto formula = formulas.find(var_name);
+    if (formula == formulas.end())
         return false;
+    for (const string& name : inputs_of(formula->second, false))
+        if (depends_on(name, input))
+            return true;
+    return false;
 }
 
-void Context::copy_to(const string& from_var, const string& to_var)
+// Variables read by the expression and by the bodies of the user functions it calls, directly
+// or through other functions. With functions, the called ones are listed too, as "f()", so that
+// redefining a function invalidates the formulas calling it.
+vector<string> Context::inputs_of(const Expression& expression, bool with_functions)
 {
-    update_variable(to_var, variables.at(from_var)->clone());
-}
\ No newline at end of file
+    vector<string> names = expression.variable_names();
+    vector<string> called = expression.function_names();
+    for (size_t i = 0; i != called.size(); i++)
+    {
+        if (with_functions)
+            names.push_back(called[i] + "()");
+        auto function = functions.find(called[i]);
+        if (function == functions.end())
+            continue;
+        for (const string& name : function->second.variable_names())
+            if (find(names.begin(), names.end(), name) == names.end())
+                names.push_back(name);
+        for (const string& name : function->second.function_names())
+            if (find(called.begin(), called.end(), name) == called.end())
+                called.push_back(name);
+    }
+    return names;
+}
+
+void Context::forget_formula(const string& var_name)
+{
+    auto formula = formulas.find(var_name);
+    if (formula == formulas.end())
+        return;
+    // The same inputs define() added edges for, functions and what their bodies read included
+    for (const string& input : inputs_of(formula->second, true))
+        dependents[input].erase(var_name);
+    formulas.erase(formula);
+}
+
+// Drops the cached values computed from var_name. A formula without a value has no
+// computed dependents either, so the walk stops there. Only formulas are dropped: a plain
+// value could not be computed again.
+void Context::invalidate_dependents(const string& var_name)
+{
+    auto readers = dependents.find(var_name);
+    if (readers == dependents.end())
+        return;
+    for (const string& reader : readers->second)
+        if (formulas.find(reader) != formulas.end() && has_variable(reader))
+        {
+            erase_variable(reader);
+            invalidate_dependents(reader);
+        }
+}
+
+bool Context::define(const string& var_name, const Expression& expression)
+{
+    vector<string> inputs = inputs_of(expression, true);
+    bool self_reference = any_of(inputs.begin(), inputs.end(),
+                                 [this, &var_name](const string& input) { return depends_on(input, var_name); });
+    if (self_reference)
+    {
+        // X = X + 1 reads the current X, so it is evaluated right away and X becomes a plain value
+        if (!expression_to_TEMP(expression))
+            return false;
+        forget_formula(var_name);
+        copy_to(TEMP_VAR, var_name);
+        clear_TEMP();
+        invalidate_dependents(var_name);
+        return true;
+    }
+
+    forget_formula(var_name);
+    formulas.emplace(var_name, expression);
+    for (const string& input : inputs)
+        dependents[input].insert(var_name);
+
+    erase_variable(var_name);
+    invalidate_dependents(var_name);
+    return true;
+}
+
+// Makes sure var_name has a value, computing its formula (and the formulas it reads) if needed
+bool Context::resolve(const string& var_name)
+{
+    if (has_variable(var_name))
+        return true;
+    auto formula = formulas.find(var_name);
+    if (formula == formulas.end())
+        return false;
+
+    Expression expression = formula->second;
+    if (!expression_to_TEMP(expression))
+        return false;
+    copy_to(TEMP_VAR, var_name);
+    clear_TEMP();
+    return true;
+}
@@ -1,25 +1,191 @@
 #pragma once
+#include <iosfwd>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
+#include <unordered_set>
+#include "arena.hpp"
+#include "kernel_registry.hpp"
+#include "result_cache.hpp"
+#include "snapshot.hpp"
 #include "../types/var_types.hpp"
 #include "../parsing/expression.hpp"
 
+struct Frame;
+
 struct Context
 {
     static std::string const TEMP_VAR;
+    static const std::size_t MAX_CALL_DEPTH;
     Context();
     ~Context();
 
     void update_variable(const std::string& var_name, GenericValue* value);
+    // The value may be shared with the result cache or other variables, so it is never written
+    void update_variable(const std::string& var_name, std::shared_ptr<GenericValue> value);
 
-    bool expression_to_TEMP(Expression expression);
+    bool expression_to_TEMP(const Expression& expression);
+    void clear_TEMP();
 
-    inline bool has_variable(const std::string& var_name) { return (variables.find(var_name) != variables.end()); };
+    bool has_variable(const std::string& var_name);
     inline bool has_unary_function(const std::string& func_name)
-    { return (unary_functions.find(func_name) != unary_functions.end()); }
-    inline GenericValue* get_variable(const std::string& var_name) { return variables.at(var_name); }
+    { return KernelRegistry::shared().find(func_name, 1) != nullptr; }
+    GenericValue* get_variable(const std::string& var_name);
+
+    // User functions of one argument; the body refers to it through parameter tokens.
+    // Redefining a function replaces it for every later call.
+    void define_function(const std::string& name, const Expression& body);
 
     void copy_to(const std::string& from_var, const std::string& to_var);
+
+    // Workspace snapshots: load only registers the stored variables, each one is built
+    // from the mapped file the first time it is read
+    bool save_workspace(const std::string& path);
+    bool load_workspace(const std::string& path);
+    // Builds the loaded variables still read from the file at path, which can then be overwritten
+    bool release_file(const std::string& path);
+
+    // Streams used by commands for results and error messages. A thread running a command
+    // can redirect them for the duration of a Redirect, e.g. to order parallel output.
+    std::ostream& output();
+    std::ostream& errors();
+    struct Redirect
+    {
+        Redirect(std::ostream* output, std::ostream* errors);
+        ~Redirect();
+    private:
+        std::ostream* previous_output;
+        std::ostream* previous_errors;
+    };
+    // A thread waiting for pool tasks inside a command may pick up another command; that one
+    // runs with evaluation state of its own, and outside the arena of the first command,
+    // for the duration of an Isolation
+    struct Isolation
+    {
+        Isolation();
+        ~Isolation();
+        Isolation(const Isolation&) = delete;
+        Isolation& operator=(const Isolation&) = delete;
+    private:
+        Frame* previous;
+        Frame* own;
+        Arena::Scope heap;
+    };
+
+    // Statements of a repeat body run many times in a row, alone, so for the duration of Slots
+    // their expressions read variables through entries of the variables map looked up once,
+    // and again only after entries are added or removed, and results are not cached.
+    // Inactive in lazy mode, where reads go through formulas.
+    struct Slots
+    {
+        explicit Slots(Context* context);
+        ~Slots();
+        Slots(const Slots&) = delete;
+        Slots& operator=(const Slots&) = delete;
+    private:
+        friend struct Context;
+        const Expression& bind(const Expression& expression);
+        GenericValue* read(int slot);
+
+        Context* context;
+        Slots* previous;
+        bool active;
+        std::vector<std::string> names;
+        std::vector<std::shared_ptr<GenericValue>*> entries;
+        unsigned long layout;
+        std::unordered_map<const Expression*, Expression> bound;
+    };
+
+    // Lazy mode: assignments only record a formula, which is evaluated when an output or
+    // another formula needs its value and invalidated when one of its inputs is reassigned
+    inline void set_lazy(bool enabled) { lazy = enabled; }
+    inline bool is_lazy() const { return lazy; }
+    bool define(const std::string& var_name, const Expression& expression);
+
+    // Output commands print large matrices as their shape and corners only
+    inline void set_summary(bool enabled) { summary = enabled; }
+    inline bool is_summary() const { return summary; }
+
+    inline ResultCache& result_cache() { return results; }
+
+    // Memory accounting: the values held in memory are counted in bytes, and once they exceed
+    // the budget the least recently read matrices are spilled to a temporary snapshot file,
+    // from which their next read loads them back. A running command may hold values it has
+    // read, so enforce_budget() is only called while no command runs. 0 means no budget.
+    struct MemoryUsage
+    {
+        std::string name;
+        std::size_t bytes;
+        bool resident;
+    };
+    struct MemoryStatistics
+    {
+        std::size_t resident_bytes;
+        std::size_t stored_bytes;
+        unsigned long spills;
+        unsigned long reloads;
+        // Every variable, largest first
+        std::vector<MemoryUsage> variables;
+    };
+    inline void set_memory_budget(std::size_t bytes) { memory_budget = bytes; }
+    inline std::size_t get_memory_budget() const { return memory_budget; }
+    void enforce_budget();
+    MemoryStatistics memory_statistics();
 private:
-    std::unordered_map<std::string, GenericValue*> variables;
-    std::unordered_map<std::string, bool (*)(GenericValue*, GenericValue**)> unary_functions;
-};
\ No newline at end of file
+    void erase_variable(const std::string& var_name);
+    GenericValue* materialize(const std::string& var_name);
+    void touch(const std::string& var_name);
+    std::string spill_path();
+    bool resolve(const std::string& var_name);
+    std::vector<std::string> inputs_of(const Expression& expression, bool with_functions);
+    bool depends_on(const std::string& var_name, const std::string& input);
+    void forget_formula(const std::string& var_name);
+    void invalidate_dependents(const std::string& var_name);
+
+    GenericValue* operand(const Token& token);
+    bool call(const Expression& body, GenericValue* argument, GenericValue** result);
+    bool apply_kernel(const Kernel& kernel, const Expression& expression, int& position, GenericValue** result);
+    bool is_writable(const Expression& expression, int position, GenericValue* value);
+    bool evaluate(const Expression& expression, int& position, GenericValue** result);
+    bool is_fusable(const Expression& expression, int position);
+    bool evaluate_product(const Expression& expression, int& position,
+                          RationalNumber& scale, std::vector<GenericValue*>& matrices);
+    bool evaluate_fused(const Expression& expression, int& position, GenericValue** result);
+    bool apply_fused(const RationalNumber& alpha, std::vector<GenericValue*>& matrices,
+                     const RationalNumber& beta, GenericValue* addend, GenericValue** result);
+
+    unsigned long version_of(const std::string& var_name);
+    std::string cache_key(const Expression& expression, int start, int end);
+    bool cached_result(const Expression& expression, int start, int end, bool has_matrix_operand,
+                       std::string& key, GenericValue** result);
+    bool store_result(const std::string& key, GenericValue** result);
+
+    // Values of one command live in the arena of the thread evaluating it, so several commands
+    // may run at once; the variables map itself is guarded by variables_lock
+    std::unordered_map<std::string, std::shared_ptr<GenericValue>> variables;
+    std::shared_mutex variables_lock;
+    std::unordered_map<std::string, std::pair<std::shared_ptr<Snapshot>, std::size_t>> stored;
+    // Changed only by definitions, which the scheduler runs alone
+    std::unordered_map<std::string, Expression> functions;
+
+    ResultCache results;
+    std::unordered_map<std::string, unsigned long> versions;
+    unsigned long last_version;
+    // Bumped under variables_lock whenever an entry of variables is added or removed
+    unsigned long layout;
+
+    std::size_t memory_budget;
+    // Bytes of the values in variables, guarded by variables_lock like the map
+    std::size_t resident_bytes;
+    unsigned long spills;
+    unsigned long reloads;
+    // Read clock of every variable while there is a budget; reads only hold variables_lock shared
+    std::unordered_map<std::string, unsigned long> last_use;
+    unsigned long use_clock;
+    std::mutex usage_lock;
+
+    bool lazy;
+    bool summary;
+    std::unordered_map<std::string, Expression> formulas;
+    std::unordered_map<std::string, std::unordered_set<std::string>> dependents;
+};
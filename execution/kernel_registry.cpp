@@ -0,0 +1,113 @@
+#include "kernel_registry.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PLUGIN_LOADING
+#include <dlfcn.h>
+#endif
+
+using namespace std;
+
+// ==== Kernel registry implementation ====
+
+const size_t Kernel::MAX_ARITY = 8;
+
+bool Kernel::accepts(GenericValue* const* arguments) const
+{
+    for (size_t i = 0; i != parameters.size(); i++)
+        if ((parameters[i] == PARAMETER_SCALAR && arguments[i]->get_type() != RATIONAL_NUMBER)
+                || (parameters[i] == PARAMETER_MATRIX && arguments[i]->get_type() != MATRIX))
+            return false;
+    return true;
+}
+
+// Built-in operations of one argument as kernels
+template <bool (*operation)(GenericValue*, GenericValue**)>
+static bool unary_kernel(GenericValue* const* arguments, GenericValue** result)
+{
+    return operation(arguments[0], result);
+}
+
+KernelRegistry::KernelRegistry() :
+    kernels(unordered_map<string, vector<Kernel>>())
+{
+    add("T", {PARAMETER_MATRIX}, unary_kernel<T>);
+    add("-", {PARAMETER_ANY}, unary_kernel<unary_minus>);
+    add("sum", {PARAMETER_MATRIX}, unary_kernel<reduce_sum>);
+    add("trace", {PARAMETER_MATRIX}, unary_kernel<reduce_trace>);
+    add("max", {PARAMETER_MATRIX}, unary_kernel<reduce_max>);
+    add("frobenius2", {PARAMETER_MATRIX}, unary_kernel<reduce_frobenius2>);
+}
+
+KernelRegistry& KernelRegistry::shared()
+{
+    static KernelRegistry registry;
+    return registry;
+}
+
+bool KernelRegistry::add(const string& name, vector<ParameterType> parameters, KernelFunction function)
+{
+    return function != nullptr && insert(Kernel{name, std::move(parameters), function, nullptr});
+}
+
+bool KernelRegistry::add_in_place(const string& name, vector<ParameterType> parameters, InPlaceKernel function)
+{
+    if (function == nullptr || parameters.empty() || parameters[0] != PARAMETER_MATRIX)
+        return false;
+    return insert(Kernel{name, std::move(parameters), nullptr, function});
+}
+
+bool KernelRegistry::insert(Kernel kernel)
+{
+    if (kernel.name.empty() || kernel.parameters.empty() || kernel.parameters.size() > Kernel::MAX_ARITY
+            || find(kernel.name, kernel.parameters.size()) != nullptr)
+        return false;
+    kernels[kernel.name].push_back(std::move(kernel));
+    return true;
+}
+
+const Kernel* KernelRegistry::find(const string& name, size_t arity) const
+{
+    auto overloads = kernels.find(name);
+    if (overloads == kernels.end())
+        return nullptr;
+    for (const Kernel& kernel : overloads->second)
+        if (kernel.parameters.size() == arity)
+            return &kernel;
+    return nullptr;
+}
+
+#ifdef PLUGIN_LOADING
+
+bool KernelRegistry::load_plugin(const string& path, string& error)
+{
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr)
+    {
+        error = dlerror();
+        return false;
+    }
+    auto register_kernels = reinterpret_cast<bool (*)(KernelRegistry&, int)>(dlsym(handle, "register_kernels"));
+    if (register_kernels == nullptr)
+    {
+        error = "no register_kernels function";
+        dlclose(handle);
+        return false;
+    }
+    // Kernels registered before a failure keep pointing into the plugin, so it stays loaded
+    if (!register_kernels(*this, API_VERSION))
+    {
+        error = "the plugin rejected API version " + to_string(API_VERSION) + " or some of its kernels";
+        return false;
+    }
+    return true;
+}
+
+#else
+
+bool KernelRegistry::load_plugin(const string&, string& error)
+{
+    error = "plugins need dynamic loading, which this platform does not provide";
+    return false;
+}
+
+#endif
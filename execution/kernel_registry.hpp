@@ -0,0 +1,69 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../types/var_types.hpp"
+
+// ==== Kernel registry declaration ====
+
+// Functions called from expressions as name(argument, ...), found by name and number of
+// arguments. The built-in T, -, sum, trace, max and frobenius2 are registered on first use of
+// the registry, shared-object plugins add their own kernels with load_plugin(). Every kernel
+// declares the types of its parameters and is only called with arguments of those types, so
+// it may cast them without checking. Kernels must not keep state: results are cached and several commands may call
+// the same kernel at once. Registration happens before evaluation starts; afterwards the
+// registry is only read and needs no locking.
+//
+// A plugin exports
+//     extern "C" bool register_kernels(KernelRegistry& registry, int api_version);
+// which returns false when api_version differs from the API_VERSION it was compiled with.
+// Plugins use the value types and the allocator of the executable, which is therefore
+// linked with -rdynamic. Loaded plugins stay loaded until the process exits.
+
+enum ParameterType
+{
+    PARAMETER_SCALAR,
+    PARAMETER_MATRIX,
+    PARAMETER_ANY
+};
+
+// Stores a new value into *result; values created with new land in the arena of the command
+typedef bool (*KernelFunction)(GenericValue* const* arguments, GenericValue** result);
+// Overwrites target, the first argument, with the result; arguments holds the other ones
+typedef bool (*InPlaceKernel)(Matrix& target, GenericValue* const* arguments);
+
+struct Kernel
+{
+    static const std::size_t MAX_ARITY;
+
+    std::string name;
+    std::vector<ParameterType> parameters;
+    KernelFunction function;
+    InPlaceKernel in_place;
+
+    bool accepts(GenericValue* const* arguments) const;
+};
+
+struct KernelRegistry
+{
+    // Compiled into the plugins, unlike the other constants, so they can compare it with the executable's
+    static constexpr int API_VERSION = 1;
+    static KernelRegistry& shared();
+
+    KernelRegistry(const KernelRegistry&) = delete;
+    KernelRegistry& operator=(const KernelRegistry&) = delete;
+
+    // Both fail for a name already taken with the same number of parameters
+    bool add(const std::string& name, std::vector<ParameterType> parameters, KernelFunction function);
+    // The first parameter is a matrix. The kernel gets it to update when it is a temporary
+    // result of the expression being evaluated, and a copy of it otherwise.
+    bool add_in_place(const std::string& name, std::vector<ParameterType> parameters, InPlaceKernel function);
+
+    const Kernel* find(const std::string& name, std::size_t arity) const;
+    bool load_plugin(const std::string& path, std::string& error);
+private:
+    KernelRegistry();
+    bool insert(Kernel kernel);
+
+    std::unordered_map<std::string, std::vector<Kernel>> kernels;
+};
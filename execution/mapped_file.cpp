@@ -0,0 +1,86 @@
+#include <fstream>
+#include <iterator>
+#include "mapped_file.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// ==== Mapped file implementation ====
+
+MappedFile::MappedFile(const string& path, bool read_fallback) :
+    memory(nullptr), length(0), mapped(false), opened(false), device(0), inode(0), contents(vector<char>())
+{
+#ifdef MAPPED_FILE_MMAP
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        return;
+    struct stat info;
+    if (fstat(descriptor, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        if (info.st_size == 0)
+            opened = true;
+        else
+        {
+            void* region = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (region != MAP_FAILED)
+            {
+                madvise(region, info.st_size, MADV_SEQUENTIAL);
+                memory = static_cast<const char*>(region);
+                length = info.st_size;
+                mapped = opened = true;
+                device = info.st_dev;
+                inode = info.st_ino;
+            }
+        }
+    }
+    close(descriptor);
+#endif
+    if (opened || !read_fallback)
+        return;
+
+    ifstream file(path, ios::binary);
+    if (!file.good())
+        return;
+    contents.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    memory = contents.data();
+    length = contents.size();
+    opened = true;
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef MAPPED_FILE_MMAP
+    if (mapped)
+        munmap(const_cast<char*>(memory), length);
+#endif
+}
+
+bool MappedFile::maps(const string& path) const
+{
+#ifdef MAPPED_FILE_MMAP
+    struct stat info;
+    return mapped && stat(path.c_str(), &info) == 0 && info.st_dev == device && info.st_ino == inode;
+#else
+    return false;
+#endif
+}
+
+void MappedFile::release(size_t offset, size_t size) const
+{
+#ifdef MAPPED_FILE_MMAP
+    if (!mapped)
+        return;
+    size_t page = size_t(sysconf(_SC_PAGESIZE));
+    size_t first = (offset + page - 1) / page * page;
+    size_t last = (offset + size) / page * page;
+    if (first < last)
+        madvise(const_cast<char*>(memory) + first, last - first, MADV_DONTNEED);
+#endif
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// ==== Mapped file declaration ====
+
+// Read-only view of a whole regular file, memory-mapped where the platform allows it.
+// Pipes and devices are never mapped; with read_fallback they (and unmappable files)
+// are read into memory instead, otherwise the file is reported as not good.
+
+struct MappedFile
+{
+    MappedFile(const std::string& path, bool read_fallback);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    inline bool good() const { return opened; }
+    inline const char* data() const { return memory; }
+    inline std::size_t size() const { return length; }
+    // Whether path names the file that is mapped, which must not be truncated while mapped
+    bool maps(const std::string& path) const;
+    // Drops the pages inside [offset, offset + size) from memory; they are read again if touched
+    void release(std::size_t offset, std::size_t size) const;
+private:
+    const char* memory;
+    std::size_t length;
+    bool mapped;
+    bool opened;
+    unsigned long long device;
+    unsigned long long inode;
+    std::vector<char> contents;
+};
@@ -0,0 +1,59 @@
+#include <cstring>
+#include "output_buffer.hpp"
+
+using namespace std;
+
+// ==== Output buffer implementation ====
+
+const size_t OutputBuffer::CAPACITY = 1 << 20;
+
+OutputBuffer::OutputBuffer(ostream& stream) :
+    stream(stream), target(stream.rdbuf()), buffer(vector<char>(CAPACITY))
+{
+    setp(buffer.data(), buffer.data() + buffer.size());
+    stream.rdbuf(this);
+}
+
+OutputBuffer::~OutputBuffer()
+{
+    sync();
+    stream.rdbuf(target);
+}
+
+bool OutputBuffer::drain()
+{
+    streamsize pending = pptr() - pbase();
+    if (pending > 0 && target->sputn(pbase(), pending) != pending)
+        return false;
+    setp(buffer.data(), buffer.data() + buffer.size());
+    return true;
+}
+
+OutputBuffer::int_type OutputBuffer::overflow(int_type character)
+{
+    if (!drain())
+        return traits_type::eof();
+    if (!traits_type::eq_int_type(character, traits_type::eof()))
+        return sputc(traits_type::to_char_type(character));
+    return traits_type::not_eof(character);
+}
+
+// Blocks larger than the whole buffer bypass it once the pending output is written
+streamsize OutputBuffer::xsputn(const char_type* text, streamsize count)
+{
+    if (count > epptr() - pptr())
+    {
+        if (!drain())
+            return 0;
+        if (count >= epptr() - pbase())
+            return target->sputn(text, count);
+    }
+    memcpy(pptr(), text, count);
+    pbump(int(count));
+    return count;
+}
+
+int OutputBuffer::sync()
+{
+    return (drain() && target->pubsync() == 0) ? 0 : -1;
+}
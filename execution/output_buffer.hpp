@@ -0,0 +1,31 @@
+#pragma once
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+// ==== Output buffer declaration ====
+
+// Large buffer installed in place of a stream's own buffer for the lifetime of the object.
+// Everything written to the stream is collected here and handed to the original buffer
+// in big blocks: when it fills up, on an explicit flush (e.g. std::cin flushing the tied
+// std::cout before reading a console line) and on destruction.
+
+struct OutputBuffer : std::streambuf
+{
+    static const std::size_t CAPACITY;
+
+    explicit OutputBuffer(std::ostream& stream);
+    ~OutputBuffer() override;
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+protected:
+    int_type overflow(int_type character) override;
+    std::streamsize xsputn(const char_type* text, std::streamsize count) override;
+    int sync() override;
+private:
+    bool drain();
+
+    std::ostream& stream;
+    std::streambuf* target;
+    std::vector<char> buffer;
+};
@@ -0,0 +1,123 @@
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include "profiler.hpp"
+
+using namespace std;
+
+// ==== Profiling counters implementation ====
+
+#ifdef MATH_PROFILE
+const bool Profiler::ENABLED = true;
+#else
+const bool Profiler::ENABLED = false;
+#endif
+
+static const char* const PHASE_NAMES[PROFILE_PHASES] = {
+    "parse", "evaluate", "operation", "matrix construct", "clone", "simplify"
+};
+
+enum ProfileCounter
+{
+    CALLS,
+    ELEMENTS,
+    ALLOCATIONS,
+    BYTES_COPIED,
+    NANOSECONDS,
+    COUNTERS
+};
+
+// Written only by the owning thread, so plain load and store are enough; the atomics only
+// make reads from print() well defined
+struct CounterBlock
+{
+    atomic<uint64_t> values[PROFILE_PHASES][COUNTERS];
+
+    inline void add(ProfilePhase phase, ProfileCounter counter, uint64_t amount)
+    {
+        atomic<uint64_t>& value = values[phase][counter];
+        value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+};
+
+// Blocks outlive their threads so that print() still sees what finished threads counted
+static mutex blocks_lock;
+static vector<unique_ptr<CounterBlock>>& all_blocks()
+{
+    static vector<unique_ptr<CounterBlock>>* blocks = new vector<unique_ptr<CounterBlock>>();
+    return *blocks;
+}
+
+static CounterBlock& own_block()
+{
+    static thread_local CounterBlock* block = nullptr;
+    if (block == nullptr)
+    {
+        block = new CounterBlock();
+        for (auto& phase : block->values)
+            for (auto& value : phase)
+                value.store(0, memory_order_relaxed);
+        lock_guard<mutex> guard(blocks_lock);
+        all_blocks().emplace_back(block);
+    }
+    return *block;
+}
+
+void Profiler::count(ProfilePhase phase, uint64_t elements, uint64_t allocations, uint64_t bytes_copied)
+{
+    CounterBlock& block = own_block();
+    block.add(phase, ELEMENTS, elements);
+    block.add(phase, ALLOCATIONS, allocations);
+    block.add(phase, BYTES_COPIED, bytes_copied);
+}
+
+Profiler::Scope::Scope(ProfilePhase phase) :
+    phase(phase), start(chrono::steady_clock::now())
+{}
+
+Profiler::Scope::~Scope()
+{
+    CounterBlock& block = own_block();
+    block.add(phase, CALLS, 1);
+    block.add(phase, NANOSECONDS, uint64_t(chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now() - start).count()));
+}
+
+void Profiler::reset()
+{
+    lock_guard<mutex> guard(blocks_lock);
+    for (auto& block : all_blocks())
+        for (auto& phase : block->values)
+            for (auto& value : phase)
+                value.store(0, memory_order_relaxed);
+}
+
+void Profiler::print(ostream& out)
+{
+    if (!ENABLED)
+    {
+        out << "Profiling counters are not compiled in, rebuild with -DMATH_PROFILE\n";
+        return;
+    }
+    uint64_t totals[PROFILE_PHASES][COUNTERS] = {};
+    {
+        lock_guard<mutex> guard(blocks_lock);
+        for (auto& block : all_blocks())
+            for (int phase = 0; phase != PROFILE_PHASES; phase++)
+                for (int counter = 0; counter != COUNTERS; counter++)
+                    totals[phase][counter] += block->values[phase][counter].load(memory_order_relaxed);
+    }
+
+    out << left << setw(18) << "Phase" << right << setw(12) << "calls" << setw(14) << "elements"
+        << setw(13) << "allocations" << setw(15) << "bytes copied" << setw(12) << "time ms" << "\n";
+    for (int phase = 0; phase != PROFILE_PHASES; phase++)
+        out << left << setw(18) << PHASE_NAMES[phase] << right
+            << setw(12) << totals[phase][CALLS] << setw(14) << totals[phase][ELEMENTS]
+            << setw(13) << totals[phase][ALLOCATIONS] << setw(15) << totals[phase][BYTES_COPIED]
+            << setw(12) << fixed << setprecision(3) << totals[phase][NANOSECONDS] / 1e6 << "\n";
+    out.unsetf(ios::floatfield);
+    out << "Times are inclusive: a phase also counts the phases it runs, e.g. operations their"
+        << " matrix constructions\n";
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+
+// ==== Profiling counters declaration ====
+
+// Per-phase counters of calls, processed elements, allocations, copied bytes and time.
+// Every thread updates its own block of counters, print() sums the blocks of all threads.
+// The counters are only compiled in with -DMATH_PROFILE; otherwise the PROFILE_ macros
+// expand to nothing and the instrumented code is exactly the uninstrumented one.
+
+enum ProfilePhase
+{
+    PROFILE_PARSE,
+    PROFILE_EVALUATE,
+    PROFILE_OPERATION,
+    PROFILE_MATRIX_CONSTRUCT,
+    PROFILE_CLONE,
+    PROFILE_SIMPLIFY,
+    PROFILE_PHASES
+};
+
+struct Profiler
+{
+    static const bool ENABLED;
+
+    static void count(ProfilePhase phase, std::uint64_t elements, std::uint64_t allocations,
+                      std::uint64_t bytes_copied);
+    static void print(std::ostream& out);
+    static void reset();
+
+    // Counts one call of the phase and the time until the end of the enclosing block
+    struct Scope
+    {
+        explicit Scope(ProfilePhase phase);
+        ~Scope();
+    private:
+        ProfilePhase phase;
+        std::chrono::steady_clock::time_point start;
+    };
+};
+
+#ifdef MATH_PROFILE
+#define PROFILE_SCOPE(phase) Profiler::Scope profile_scope(phase)
+#define PROFILE_COUNT(phase, elements, allocations, bytes_copied) \
+    Profiler::count(phase, elements, allocations, bytes_copied)
+#else
+#define PROFILE_SCOPE(phase) ((void)0)
+#define PROFILE_COUNT(phase, elements, allocations, bytes_copied) ((void)0)
+#endif
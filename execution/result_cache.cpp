@@ -0,0 +1,73 @@
+#include "result_cache.hpp"
+#include "../types/var_types.hpp"
+
+using namespace std;
+
+const size_t ResultCache::DEFAULT_BUDGET = 64 * 1024 * 1024;
+
+ResultCache::ResultCache(size_t budget) :
+    entries(list<Entry>()), index(unordered_map<string, list<Entry>::iterator>()),
+    budget(budget), bytes(0), hits(0), misses(0), evictions(0)
+{}
+
+ResultCache::~ResultCache()
+{
+    clear();
+}
+
+shared_ptr<GenericValue> ResultCache::find(const string& key)
+{
+    lock_guard<mutex> guard(lock);
+    auto found = index.find(key);
+    if (found == index.end())
+    {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second->value;
+}
+
+// Takes ownership of value; if another evaluation stored the same key first, its value is returned
+shared_ptr<GenericValue> ResultCache::insert(const string& key, GenericValue* value)
+{
+    shared_ptr<GenericValue> stored(value);
+    lock_guard<mutex> guard(lock);
+    auto found = index.find(key);
+    if (found != index.end())
+        return found->second->value;
+
+    size_t value_bytes = value->byte_size();
+    entries.push_front(Entry{key, stored, value_bytes});
+    index.emplace(key, entries.begin());
+    bytes += value_bytes;
+    trim();
+    return stored;
+}
+
+void ResultCache::trim()
+{
+    while (bytes > budget && !entries.empty())
+    {
+        Entry& last = entries.back();
+        bytes -= last.bytes;
+        index.erase(last.key);
+        entries.pop_back();
+        evictions++;
+    }
+}
+
+void ResultCache::clear()
+{
+    lock_guard<mutex> guard(lock);
+    entries.clear();
+    index.clear();
+    bytes = 0;
+}
+
+ResultCache::Statistics ResultCache::statistics()
+{
+    lock_guard<mutex> guard(lock);
+    return Statistics{hits, misses, evictions, entries.size(), bytes};
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct GenericValue;
+
+// ==== Operation result cache declaration ====
+
+// Bounded LRU cache of operation results. Keys spell the operation together with the
+// identity of its operands (variable versions, literal texts), so a hit is only possible
+// while none of the inputs changed. Values are shared with the evaluations that found them
+// and the variables they were assigned to, so least recently used entries can be evicted as
+// soon as the budget is exceeded.
+
+struct ResultCache
+{
+    static const std::size_t DEFAULT_BUDGET;
+
+    struct Statistics
+    {
+        std::size_t hits;
+        std::size_t misses;
+        std::size_t evictions;
+        std::size_t entries;
+        std::size_t bytes;
+    };
+
+    explicit ResultCache(std::size_t budget);
+    ~ResultCache();
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    std::shared_ptr<GenericValue> find(const std::string& key);
+    std::shared_ptr<GenericValue> insert(const std::string& key, GenericValue* value);
+    void clear();
+
+    inline bool enabled() const { return budget != 0; }
+    inline void set_budget(std::size_t bytes) { budget = bytes; }
+    inline std::size_t get_budget() const { return budget; }
+    Statistics statistics();
+private:
+    struct Entry
+    {
+        std::string key;
+        std::shared_ptr<GenericValue> value;
+        std::size_t bytes;
+    };
+
+    void trim();
+
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::size_t budget;
+    std::size_t bytes;
+    std::size_t hits;
+    std::size_t misses;
+    std::size_t evictions;
+    std::mutex lock;
+};
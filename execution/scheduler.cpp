@@ -0,0 +1,200 @@
+#include <climits>
+#include <iostream>
+#include <sstream>
+#include "scheduler.hpp"
+
+using namespace std;
+
+// Statements running on this thread; more than one when a thread waiting inside a statement
+// picked up another one from the pool
+static thread_local int running_here = 0;
+
+Scheduler::Scheduler(Context* context, ThreadPool& pool, bool stop_at_failure) :
+    context(context), pool(pool), stop_at_failure(stop_at_failure), first_failure(INT_MAX), finished(0),
+    next_to_print(0), failure_printed(false), last_barrier(-1), running(0)
+{}
+
+Scheduler::~Scheduler()
+{
+    wait_all();
+    for (auto& node : nodes)
+        if (node->owned)
+            delete node->statement;
+}
+
+// Called with starting_lock held; a finished statement no longer holds anything back
+void Scheduler::add_edge(int from, int to)
+{
+    if (from < 0 || from == to || nodes[from]->completed)
+        return;
+    vector<int>& successors = nodes[from]->successors;
+    if (successors.empty() || successors.back() != to)
+    {
+        successors.push_back(to);
+        nodes[to]->waiting_for++;
+    }
+}
+
+int Scheduler::insert(Command* statement, bool owned, string preface)
+{
+    lock_guard<mutex> guard(starting_lock);
+    int index;
+    {
+        lock_guard<mutex> progress_guard(progress_lock);
+        index = int(nodes.size());
+        nodes.emplace_back(new Node());
+    }
+    Node& node = *nodes[index];
+    node.statement = statement;
+    node.owned = owned;
+    node.preface = std::move(preface);
+
+    vector<string> reads, writes;
+    if (!statement->dependencies(reads, writes))
+    {
+        for (int previous : since_barrier)
+            add_edge(previous, index);
+        add_edge(last_barrier, index);
+        last_barrier = index;
+        since_barrier.clear();
+        last_writer.clear();
+        readers_since_write.clear();
+    }
+    else
+    {
+        add_edge(last_barrier, index);
+        for (const string& name : reads)
+        {
+            auto writer = last_writer.find(name);
+            if (writer != last_writer.end())
+                add_edge(writer->second, index);
+            readers_since_write[name].push_back(index);
+        }
+        for (const string& name : writes)
+        {
+            auto writer = last_writer.find(name);
+            if (writer != last_writer.end())
+                add_edge(writer->second, index);
+            for (int reader : readers_since_write[name])
+                add_edge(reader, index);
+            readers_since_write[name].clear();
+            last_writer[name] = index;
+        }
+        since_barrier.push_back(index);
+    }
+
+    if (node.waiting_for == 0)
+        start(index);
+    return index;
+}
+
+int Scheduler::add(Command* statement, string preface)
+{
+    return insert(statement, true, std::move(preface));
+}
+
+void Scheduler::start(int index)
+{
+    running++;
+    Node* node = nodes[index].get();
+    pool.submit([this, index, node]
+    {
+        // Statements after a failed one will never be reported, so they are not run
+        if (!stop_at_failure || index < first_failure.load())
+        {
+            ostringstream output, errors;
+            running_here++;
+            {
+                unique_ptr<Context::Isolation> isolation(running_here > 1 ? new Context::Isolation() : nullptr);
+                Context::Redirect redirect(&output, &errors);
+                node->succeeded = node->statement->execute(context);
+            }
+            running_here--;
+            node->output = output.str();
+            node->errors = errors.str();
+            if (!node->succeeded)
+            {
+                int failure = first_failure.load();
+                while (index < failure && !first_failure.compare_exchange_weak(failure, index))
+                    ;
+            }
+        }
+        finish(index);
+    });
+}
+
+void Scheduler::finish(int index)
+{
+    {
+        lock_guard<mutex> guard(starting_lock);
+        nodes[index]->completed = true;
+        if (--running == 0)
+            context->enforce_budget();
+        for (int successor : nodes[index]->successors)
+            if (--nodes[successor]->waiting_for == 0)
+                start(successor);
+    }
+
+    lock_guard<mutex> guard(progress_lock);
+    nodes[index]->done = true;
+    finished++;
+    progress.notify_all();
+}
+
+void Scheduler::wait(int index)
+{
+    unique_lock<mutex> guard(progress_lock);
+    progress.wait(guard, [this, index] { return nodes[index]->done; });
+}
+
+void Scheduler::wait_all()
+{
+    unique_lock<mutex> guard(progress_lock);
+    progress.wait(guard, [this] { return finished == int(nodes.size()); });
+}
+
+bool Scheduler::print(bool in_order)
+{
+    lock_guard<mutex> guard(progress_lock);
+    if (failure_printed)
+        return false;
+    for (int i = next_to_print; i != int(nodes.size()); i++)
+    {
+        Node& node = *nodes[i];
+        if (node.printed)
+            continue;
+        if (!node.done)
+        {
+            if (in_order)
+                break;
+            continue;
+        }
+        context->output() << node.preface << node.output;
+        context->errors() << node.errors;
+        node.printed = true;
+        if (stop_at_failure && !node.succeeded)
+        {
+            failure_printed = true;
+            return false;
+        }
+    }
+    while (next_to_print != int(nodes.size()) && nodes[next_to_print]->printed)
+        next_to_print++;
+    return true;
+}
+
+// Prints results in program order as soon as every earlier statement is done
+bool Scheduler::run(const vector<Command*>& statements)
+{
+    int first = int(nodes.size());
+    for (Command* statement : statements)
+        insert(statement, false, string());
+    bool succeeded = true;
+    for (int i = first; i != int(nodes.size()) && succeeded; i++)
+    {
+        wait(i);
+        succeeded = print(true);
+    }
+    wait_all();
+    return succeeded;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include "commands.hpp"
+#include "thread_pool.hpp"
+
+// ==== Statement scheduler declaration ====
+
+// Runs statements on a thread pool following their read/write dependencies: a statement starts
+// once the previous writers of the variables it reads (and the previous readers and writers of
+// the variable it assigns) are done. Output is printed in program order.
+//
+// run() takes a whole script and stops at the first failing statement, exactly as in sequential
+// runs. Statements can also be added one at a time while earlier ones are running: add() only
+// records the statement and starts it when it is ready, and print() reports the finished ones.
+
+struct Scheduler
+{
+    // With stop_at_failure, statements after a failed one are neither run nor printed
+    Scheduler(Context* context, ThreadPool& pool, bool stop_at_failure);
+    ~Scheduler();
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    bool run(const std::vector<Command*>& statements);
+
+    // Takes ownership of the statement; preface is printed before its output. Returns its index.
+    int add(Command* statement, std::string preface);
+    void wait(int index);
+    void wait_all();
+    // Prints the output of finished statements in program order. In order, printing stops at the
+    // first statement still running; otherwise such statements are passed over and printed by a
+    // later call. Returns false once the failed statement has been printed when stopping at failures.
+    bool print(bool in_order);
+private:
+    struct Node
+    {
+        Command* statement = nullptr;
+        bool owned = false;
+        std::string preface;
+        // Guarded by starting_lock
+        std::vector<int> successors;
+        int waiting_for = 0;
+        bool completed = false;
+        // Guarded by progress_lock
+        std::string output;
+        std::string errors;
+        bool succeeded = false;
+        bool done = false;
+        bool printed = false;
+    };
+
+    int insert(Command* statement, bool owned, std::string preface);
+    void add_edge(int from, int to);
+    // Called with starting_lock held
+    void start(int index);
+    void finish(int index);
+
+    Context* context;
+    ThreadPool& pool;
+    bool stop_at_failure;
+    std::vector<std::unique_ptr<Node>> nodes;
+    std::atomic<int> first_failure;
+    int finished;
+    int next_to_print;
+    bool failure_printed;
+    std::mutex progress_lock;
+    std::condition_variable progress;
+
+    // Dependency tracking of the statements added so far, guarded by starting_lock;
+    // commands without declared dependencies act as barriers between everything before and after them
+    std::unordered_map<std::string, int> last_writer;
+    std::unordered_map<std::string, std::vector<int>> readers_since_write;
+    std::vector<int> since_barrier;
+    int last_barrier;
+    // Statements started and not finished; when it drops to 0 under the lock nothing runs,
+    // which is when the memory budget is enforced
+    int running;
+    std::mutex starting_lock;
+};
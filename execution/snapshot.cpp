@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "snapshot.hpp"
+
+
+using namespace std;
+
+// ==== Workspace snapshot implementation ====
+
+const char Snapshot::MAGIC[8] = {'M', 'I', 'W', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t Snapshot::VERSION = 1;
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t data_offset;
+};
+
+struct SnapshotSymbol
+{
+    uint32_t name_length;
+    uint32_t type;
+    int32_t rows;
+    int32_t cols;
+    uint64_t offset;
+};
+
+static const size_t WRITE_CHUNK = 1 << 16;
+
+static uint64_t align8(uint64_t size) { return (size + 7) & ~uint64_t(7); }
+
+static int element_count(GenericValue* value, int32_t& rows, int32_t& cols)
+{
+    rows = cols = 1;
+    if (value->get_type() == MATRIX)
+    {
+        rows = static_cast<Matrix*>(value)->rows();
+        cols = static_cast<Matrix*>(value)->cols();
+    }
+    return rows * cols;
+}
+
+static const RationalNumber& element(GenericValue* value, int k, int cols)
+{
+    if (value->get_type() == MATRIX)
+        return static_cast<Matrix*>(value)->at(k / cols, k % cols);
+    return *static_cast<RationalNumber*>(value);
+}
+
+// Writes either the numerators or the denominators of a value in WRITE_CHUNK sized blocks
+static void write_components(ofstream& file, GenericValue* value, int count, int cols, bool numerators)
+{
+    vector<int32_t> chunk;
+    chunk.reserve(min<size_t>(count, WRITE_CHUNK));
+    for (int k = 0; k != count; k++)
+    {
+        const RationalNumber& number = element(value, k, cols);
+        chunk.push_back(numerators ? number.num() : number.den());
+        if (chunk.size() == WRITE_CHUNK || k + 1 == count)
+        {
+            file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size() * sizeof(int32_t));
+            chunk.clear();
+        }
+    }
+}
+
+bool Snapshot::save(const string& path, const vector<pair<string, GenericValue*>>& values)
+{
+    uint64_t offset = sizeof(SnapshotHeader);
+    for (const auto& value : values)
+        offset += sizeof(SnapshotSymbol) + align8(value.first.size());
+
+    SnapshotHeader header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.count = uint32_t(values.size());
+    header.data_offset = offset;
+
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file.good())
+        return false;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    const char padding[8] = {};
+    for (const auto& value : values)
+    {
+        SnapshotSymbol symbol;
+        symbol.name_length = uint32_t(value.first.size());
+        symbol.type = value.second->get_type();
+        int count = element_count(value.second, symbol.rows, symbol.cols);
+        symbol.offset = offset;
+        offset += align8(2 * uint64_t(count) * sizeof(int32_t));
+
+        file.write(reinterpret_cast<const char*>(&symbol), sizeof(symbol));
+        file.write(value.first.data(), value.first.size());
+        file.write(padding, align8(value.first.size()) - value.first.size());
+    }
+
+    for (const auto& value : values)
+    {
+        int32_t rows, cols;
+        int count = element_count(value.second, rows, cols);
+        write_components(file, value.second, count, cols, true);
+        write_components(file, value.second, count, cols, false);
+        uint64_t size = 2 * uint64_t(count) * sizeof(int32_t);
+        file.write(padding, align8(size) - size);
+    }
+    file.flush();
+    return file.good();
+}
+
+Snapshot::Snapshot() :
+    file(nullptr), table(vector<Entry>()), temporary_path(string())
+{}
+
+Snapshot::~Snapshot()
+{
+    delete file;
+    if (!temporary_path.empty())
+        remove(temporary_path.c_str());
+}
+
+shared_ptr<Snapshot> Snapshot::open(const string& path)
+{
+    shared_ptr<Snapshot> snapshot(new Snapshot());
+    snapshot->file = new MappedFile(path, true);
+    if (!snapshot->file->good() || !snapshot->read_table())
+        return nullptr;
+    return snapshot;
+}
+
+shared_ptr<Snapshot> Snapshot::open_temporary(const string& path)
+{
+    shared_ptr<Snapshot> snapshot = open(path);
+    if (snapshot == nullptr)
+        remove(path.c_str());
+    else
+        snapshot->temporary_path = path;
+    return snapshot;
+}
+
+// Checks the header and that every value lies inside the file
+bool Snapshot::read_table()
+{
+    const char* mapping = file->data();
+    size_t mapping_size = file->size();
+    SnapshotHeader header;
+    if (mapping_size < sizeof(header))
+        return false;
+    memcpy(&header, mapping, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION)
+        return false;
+
+    uint64_t position = sizeof(header);
+    for (uint32_t i = 0; i != header.count; i++)
+    {
+        SnapshotSymbol symbol;
+        if (position + sizeof(symbol) > mapping_size)
+            return false;
+        memcpy(&symbol, mapping + position, sizeof(symbol));
+        position += sizeof(symbol);
+        if (position + symbol.name_length > mapping_size || symbol.rows <= 0 || symbol.cols <= 0
+            || (symbol.type != MATRIX && (symbol.type != RATIONAL_NUMBER || symbol.rows != 1 || symbol.cols != 1)))
+            return false;
+        uint64_t size = 2 * uint64_t(symbol.rows) * uint64_t(symbol.cols) * sizeof(int32_t);
+        if (symbol.offset < header.data_offset || symbol.offset % 8 != 0 || symbol.offset + size > mapping_size)
+            return false;
+
+        table.push_back(Entry{string(mapping + position, symbol.name_length), ValueType(symbol.type),
+                              symbol.rows, symbol.cols, symbol.offset});
+        position += align8(symbol.name_length);
+    }
+    return true;
+}
+
+// Saved numbers are already in lowest terms, so they are not simplified again.
+// Returns nullptr if the arrays hold a denominator that is not positive.
+GenericValue* Snapshot::materialize(size_t index) const
+{
+    const Entry& entry = table[index];
+    size_t count = size_t(entry.rows) * entry.cols;
+    const int32_t* numerators = reinterpret_cast<const int32_t*>(file->data() + entry.offset);
+    const int32_t* denominators = numerators + count;
+
+    GenericValue* value;
+    if (entry.type == RATIONAL_NUMBER)
+        value = denominators[0] > 0 ? new RationalNumber(RationalNumber::reduced(numerators[0], denominators[0])) : nullptr;
+    else
+    {
+        Matrix* matrix = new Matrix(entry.rows, entry.cols);
+        for (int i = 0, k = 0; i != entry.rows; i++)
+            for (int j = 0; j != entry.cols; j++, k++)
+            {
+                if (denominators[k] <= 0)
+                {
+                    delete matrix;
+                    return nullptr;
+                }
+                matrix->at(i, j) = RationalNumber::reduced(numerators[k], denominators[k]);
+            }
+        value = matrix;
+    }
+    file->release(entry.offset, 2 * count * sizeof(int32_t));
+    return value;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mapped_file.hpp"
+#include "../types/var_types.hpp"
+
+// ==== Workspace snapshot declaration ====
+
+// Binary image of a set of variables: a header, a symbol table with the name, type, shape and
+// data offset of every value, then for each value its numerators followed by its denominators
+// as contiguous int32 arrays. Opening a snapshot maps the file and only reads the symbol table;
+// a value is built from the mapped arrays when materialize() is asked for it. Values are
+// built whole, since their elements cannot alias the arrays, and the pages they came from
+// are released afterwards.
+
+struct Snapshot
+{
+    static const char MAGIC[8];
+    static const std::uint32_t VERSION;
+
+    struct Entry
+    {
+        std::string name;
+        ValueType type;
+        int rows;
+        int cols;
+        std::uint64_t offset;
+    };
+
+    static bool save(const std::string& path,
+                     const std::vector<std::pair<std::string, GenericValue*>>& values);
+    static std::shared_ptr<Snapshot> open(const std::string& path);
+    // The file is removed when the snapshot is destroyed
+    static std::shared_ptr<Snapshot> open_temporary(const std::string& path);
+
+    ~Snapshot();
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    inline const std::vector<Entry>& entries() const { return table; }
+    GenericValue* materialize(std::size_t index) const;
+    // Whether the snapshot was opened from path and still reads it
+    inline bool maps(const std::string& path) const { return file->maps(path); }
+private:
+    Snapshot();
+    bool read_table();
+
+    MappedFile* file;
+    std::vector<Entry> table;
+    std::string temporary_path;
+};
@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// ==== Single-producer single-consumer queue declaration ====
+
+// Bounded lock-free ring buffer: exactly one thread pushes and exactly one thread pops.
+// The capacity is rounded up to a power of two.
+
+template <typename T>
+struct SpscQueue
+{
+    explicit SpscQueue(std::size_t capacity);
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    bool try_push(const T& value);
+    bool try_pop(T& value);
+private:
+    std::vector<T> slots;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> head;
+    alignas(64) std::atomic<std::size_t> tail;
+};
+
+// ==== Single-producer single-consumer queue implementation ====
+
+template <typename T>
+SpscQueue<T>::SpscQueue(std::size_t capacity) :
+    head(0), tail(0)
+{
+    std::size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+    slots.resize(size);
+    mask = size - 1;
+}
+
+template <typename T>
+bool SpscQueue<T>::try_push(const T& value)
+{
+    std::size_t position = tail.load(std::memory_order_relaxed);
+    if (position - head.load(std::memory_order_acquire) == slots.size())
+        return false;
+    slots[position & mask] = value;
+    tail.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool SpscQueue<T>::try_pop(T& value)
+{
+    std::size_t position = head.load(std::memory_order_relaxed);
+    if (position == tail.load(std::memory_order_acquire))
+        return false;
+    value = slots[position & mask];
+    head.store(position + 1, std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,128 @@
+#include "thread_pool.hpp"
+
+using namespace std;
+
+// Index of the pool worker running on this thread, -1 on other threads
+static thread_local int current_worker = -1;
+static thread_local const ThreadPool* current_pool = nullptr;
+
+ThreadPool::ThreadPool(unsigned workers_number) :
+    pending(0), next_worker(0), stopping(false)
+{
+    if (workers_number == 0)
+        workers_number = 1;
+    for (unsigned i = 0; i != workers_number; i++)
+        workers.emplace_back(new Worker());
+    for (unsigned i = 0; i != workers_number; i++)
+        threads.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(idle_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread& worker_thread : threads)
+        worker_thread.join();
+}
+
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool(max(2u, thread::hardware_concurrency()));
+    return pool;
+}
+
+void ThreadPool::submit(function<void()> task)
+{
+    unsigned index = (current_pool == this)
+        ? unsigned(current_worker)
+        : next_worker.fetch_add(1, memory_order_relaxed) % size();
+    {
+        lock_guard<mutex> guard(idle_lock);
+        pending++;
+    }
+    {
+        lock_guard<mutex> guard(workers[index]->lock);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+// Own deque first (newest task), then the oldest task of any other worker
+bool ThreadPool::take(unsigned index, function<void()>& task)
+{
+    {
+        Worker& own = *workers[index];
+        lock_guard<mutex> guard(own.lock);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            pending--;
+            return true;
+        }
+    }
+    for (unsigned shift = 1; shift != size(); shift++)
+    {
+        Worker& victim = *workers[(index + shift) % size()];
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            pending--;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Lets a thread waiting for pool tasks run one of them instead of blocking
+bool ThreadPool::run_pending_task()
+{
+    function<void()> task;
+    unsigned index = (current_pool == this) ? unsigned(current_worker) : 0;
+    if (!take(index, task))
+        return false;
+    task();
+    return true;
+}
+
+// The calling thread takes part and runs pending tasks while it waits, so this may be
+// called from a task already running on the pool
+void ThreadPool::parallel_for(size_t count, const function<void(size_t)>& body)
+{
+    atomic<size_t> remaining(count);
+    for (size_t i = 1; i < count; i++)
+        submit([&body, &remaining, i] { body(i); remaining--; });
+    if (count != 0)
+    {
+        body(0);
+        remaining--;
+    }
+    while (remaining.load() != 0)
+        if (!run_pending_task())
+            this_thread::yield();
+}
+
+void ThreadPool::work(unsigned index)
+{
+    current_worker = int(index);
+    current_pool = this;
+    function<void()> task;
+    while (true)
+    {
+        if (take(index, task))
+        {
+            task();
+            task = nullptr;
+            continue;
+        }
+        unique_lock<mutex> guard(idle_lock);
+        wake.wait(guard, [this] { return stopping || pending != 0; });
+        if (stopping && pending == 0)
+            return;
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ==== Work-stealing thread pool declaration ====
+
+// Every worker owns a deque: it takes its own tasks from the back and, when it runs out,
+// steals the oldest tasks from the front of the other deques. Tasks submitted by a worker
+// land in its own deque, tasks from other threads are spread round-robin.
+
+struct ThreadPool
+{
+    explicit ThreadPool(unsigned workers_number);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+    bool run_pending_task();
+    // Runs body(0) ... body(count - 1) on the pool and returns once all of them are done
+    void parallel_for(std::size_t count, const std::function<void(std::size_t)>& body);
+    inline unsigned size() const { return unsigned(workers.size()); }
+
+    static ThreadPool& shared();
+private:
+    struct Worker
+    {
+        std::deque<std::function<void()>> tasks;
+        std::mutex lock;
+    };
+
+    bool take(unsigned index, std::function<void()>& task);
+    void work(unsigned index);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::mutex idle_lock;
+    std::condition_variable wake;
+    std::atomic<std::size_t> pending;
+    std::atomic<unsigned> next_worker;
+    bool stopping;
+};
@@ -0,0 +1,154 @@
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "tracer.hpp"
+
+using namespace std;
+
+// ==== Execution tracer implementation ====
+
+atomic<bool> Tracer::active(false);
+atomic<int> Tracer::recording_spans(0);
+
+struct TraceEvent
+{
+    const char* category;
+    string name;
+    string arguments;
+    double start;
+    double duration;
+};
+
+struct TraceBuffer
+{
+    int thread_index;
+    vector<TraceEvent> events;
+};
+
+static string trace_path;
+static chrono::steady_clock::time_point trace_start;
+static mutex buffers_lock;
+static vector<unique_ptr<TraceBuffer>> buffers;
+
+// Only registration takes the lock, recording appends to the thread's own buffer
+static TraceBuffer& own_buffer()
+{
+    static thread_local TraceBuffer* buffer = nullptr;
+    if (buffer == nullptr)
+    {
+        lock_guard<mutex> guard(buffers_lock);
+        buffers.emplace_back(new TraceBuffer{int(buffers.size()), vector<TraceEvent>()});
+        buffer = buffers.back().get();
+    }
+    return *buffer;
+}
+
+static double now_microseconds()
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - trace_start).count();
+}
+
+static string escape(const string& text)
+{
+    string result;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        if (static_cast<unsigned char>(c) < 0x20)
+            result += ' ';
+        else
+            result += c;
+    }
+    return result;
+}
+
+// The thread opening the trace is registered first and named main
+bool Tracer::open(const string& path)
+{
+    if (!ofstream(path).good())
+        return false;
+    trace_path = path;
+    trace_start = chrono::steady_clock::now();
+    own_buffer();
+    active.store(true, memory_order_release);
+    return true;
+}
+
+bool Tracer::close()
+{
+    if (!active.load(memory_order_acquire))
+        return true;
+    // A span either sees the flag cleared and does not record, or is counted here
+    active.store(false);
+    while (recording_spans.load() != 0)
+        this_thread::yield();
+
+    ofstream file(trace_path);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    lock_guard<mutex> guard(buffers_lock);
+    for (const auto& buffer : buffers)
+    {
+        file << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+             << buffer->thread_index << ", \"args\": {\"name\": \""
+             << (buffer->thread_index == 0 ? string("main") : "thread " + to_string(buffer->thread_index))
+             << "\"}}";
+        first = false;
+        for (const TraceEvent& event : buffer->events)
+            file << ",\n{\"name\": \"" << escape(event.name) << "\", \"cat\": \"" << event.category
+                 << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->thread_index
+                 << ", \"ts\": " << fixed << event.start << ", \"dur\": " << event.duration
+                 << ", \"args\": {" << event.arguments << "}}";
+        buffer->events.clear();
+    }
+    file << "\n]}\n";
+    return file.good();
+}
+
+Tracer::Span::Span(const char* category, const char* name) :
+    category(category), name(string()), arguments(string()), start(-1)
+{
+    if (!active.load(memory_order_acquire))
+        return;
+    recording_spans.fetch_add(1);
+    if (!active.load())
+    {
+        recording_spans.fetch_sub(1);
+        return;
+    }
+    this->name = name;
+    start = now_microseconds();
+}
+
+Tracer::Span::~Span()
+{
+    if (!recording())
+        return;
+    double end = now_microseconds();
+    own_buffer().events.push_back(TraceEvent{category, std::move(name), std::move(arguments), start, end - start});
+    recording_spans.fetch_sub(1, memory_order_release);
+}
+
+void Tracer::Span::set_name(string name)
+{
+    if (recording())
+        this->name = std::move(name);
+}
+
+void Tracer::Span::add_argument(const char* key, long long value)
+{
+    if (!recording())
+        return;
+    arguments += (arguments.empty() ? "\"" : ", \"") + string(key) + "\": " + to_string(value);
+}
+
+void Tracer::Span::add_argument(const char* key, const string& value)
+{
+    if (!recording())
+        return;
+    arguments += (arguments.empty() ? "\"" : ", \"") + string(key) + "\": \"" + escape(value) + "\"";
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include <string>
+
+// ==== Execution tracer declaration ====
+
+// Records timed spans (statements, their parse and output, kernel calls) while a trace is
+// open and writes them as Chrome trace-event JSON when it is closed. Every thread appends
+// to its own buffer without locking. close() stops new spans from recording and waits for the
+// ones still recording on other threads before it writes their buffers.
+// While no trace is open a Span costs one atomic load.
+
+struct Tracer
+{
+    static bool open(const std::string& path);
+    static bool close();
+    static inline bool enabled() { return active.load(std::memory_order_acquire); }
+
+    struct Span
+    {
+        Span(const char* category, const char* name);
+        ~Span();
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+        inline bool recording() const { return start >= 0; }
+        void set_name(std::string name);
+        void add_argument(const char* key, long long value);
+        void add_argument(const char* key, const std::string& value);
+    private:
+        const char* category;
+        std::string name;
+        std::string arguments;
+        double start;
+    };
+private:
+    static std::atomic<bool> active;
+    // Spans recording right now; close() waits until it drops to 0
+    static std::atomic<int> recording_spans;
+};
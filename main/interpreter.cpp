@@ -1,43 +1,107 @@
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <thread>
+#include "../execution/profiler.hpp"
+#include "../execution/scheduler.hpp"
+#include "../execution/spsc_queue.hpp"
+#include "../execution/tracer.hpp"
 #include "interpreter.hpp"
 
 using namespace std;
 
-Interpreter::Interpreter() :
-    from_file(false), file(nullptr), context(new Context())
-{}
+const size_t Interpreter::PIPELINE_DEPTH = 256;
 
-Interpreter::Interpreter(char const* path) :
-    from_file(true), file(new ifstream(path)), context(new Context())
-{}
+Interpreter::Interpreter(Options options) :
+    output(cout), from_file(false), source(new SourceReader(cin)), context(new Context()), options(options)
+{
+    context->set_lazy(options.lazy);
+    context->result_cache().set_budget(options.cache_budget);
+    context->set_summary(options.summary);
+    context->set_memory_budget(options.memory_budget);
+}
+
+Interpreter::Interpreter(char const* path, Options options) :
+    output(cout), from_file(true), source(new SourceReader(path)), context(new Context()), options(options)
+{
+    context->set_lazy(options.lazy);
+    context->result_cache().set_budget(options.cache_budget);
+    context->set_summary(options.summary);
+    context->set_memory_budget(options.memory_budget);
+}
 
 Interpreter::~Interpreter()
 {
     delete context;
-    delete file;
+    delete source;
 }
 
 void Interpreter::run()
 {
+    if (options.trace != nullptr && !Tracer::open(options.trace))
+        cerr << "Error with opening trace file " << options.trace << ". Tracing is off." << endl;
     if (from_file)
         run_from_file();
     else
         run_from_console();
+    if (options.stats)
+        Profiler::print(cout);
+    if (Tracer::enabled() && !Tracer::close())
+        cerr << "Error with writing trace file " << options.trace << "." << endl;
+}
+
+string Interpreter::optimized_text(Command* command) const
+{
+    if (options.print_optimized && command->is_correct() && !command->to_string().empty())
+        return "~> " + command->to_string() + '\n';
+    return string();
+}
+
+void Interpreter::print_optimized(Command* command)
+{
+    cout << optimized_text(command);
+}
+
+// Reads and parses the next statement, remembering the line it started at.
+// Returns nullptr at the end of the source.
+Command* Interpreter::next_command()
+{
+    string_view command_string;
+    if (!source->next_line(command_string))
+        return nullptr;
+    int line = source->line_number();
+    Tracer::Span span("parse", "parse");
+    if (span.recording())
+    {
+        span.set_name("parse line " + to_string(line));
+        span.add_argument("line", line);
+    }
+    Command* command = parse_command(command_string, *source);
+    command->set_line(line);
+    return command;
 }
 
 void Interpreter::run_from_console()
 {
     Command* command;
-    string command_string;
 
     cout << "<===| Simple math interpreter |===>" << endl;
     cout << "=> ";
-    while (getline(cin, command_string))
+    if (options.async && !options.lazy)
+    {
+        run_console_async();
+        return;
+    }
+    while ((command = next_command()) != nullptr)
     {
-        command = parse_command(command_string);
         if (command->code() == EXIT)
+        {
+            delete command;
             break;
-        command->run(context);
+        }
+        print_optimized(command);
+        command->execute(context);
+        context->enforce_budget();
         delete command;
         cout << "=> ";
     }
@@ -45,28 +109,184 @@ void Interpreter::run_from_console()
 
 void Interpreter::run_from_file()
 {
-    if (!file->good())
+    if (!source->good())
     {
         cerr << "Error with reading file. Turning on console mode." << endl;
+        delete source;
+        source = new SourceReader(cin);
         run_from_console();
     }
+    else if (options.async && !options.lazy)
+        run_async();
+    else if (options.parallel && !options.lazy)
+        run_in_parallel();
     else
+        run_pipelined();
+}
+
+// Waits for the other side of the pipeline, yielding first and sleeping if it takes longer
+static void back_off(int& attempts)
+{
+    if (++attempts < 64)
+        this_thread::yield();
+    else
+        this_thread::sleep_for(chrono::microseconds(50));
+}
+
+// A reader thread parses upcoming lines into a bounded queue while this thread runs
+// the commands parsed earlier. The reader stops after an invalid line or EXIT, so
+// execution ends at the same line as it would without the pipeline.
+void Interpreter::run_pipelined()
+{
+    SpscQueue<Command*> parsed(PIPELINE_DEPTH);
+    atomic<bool> stopped(false);
+
+    thread reader([this, &parsed, &stopped]
     {
-        Command* command;
-        string command_string;
-        while (getline(*file, command_string))
+        bool last = false;
+        while (!last)
         {
-            command = parse_command(command_string);
-            if (!command->is_correct() || command->code() == EXIT)
-                break;
-            if (!command->run(context))
+            Command* command = next_command();
+            // Decided before the push: once queued, the command belongs to the executor
+            last = command == nullptr || !command->is_correct() || command->code() == EXIT;
+            int attempts = 0;
+            while (!parsed.try_push(command))
             {
-                cout << "Error with running command!\n";
-                delete command;
-                break;
+                if (stopped)
+                {
+                    delete command;
+                    return;
+                }
+                back_off(attempts);
             }
+        }
+    });
+
+    Command* command = nullptr;
+    while (true)
+    {
+        int attempts = 0;
+        while (!parsed.try_pop(command))
+            back_off(attempts);
+        if (command == nullptr)
+            break;
+        if (!command->is_correct() || command->code() == EXIT)
+        {
+            if (!command->is_correct())
+                command->run(context);
             delete command;
+            break;
+        }
+        print_optimized(command);
+        bool succeeded = command->execute(context);
+        context->enforce_budget();
+        delete command;
+        if (!succeeded)
+        {
+            cout << "Error with running command!\n";
+            break;
         }
-        file->close();
     }
-}
\ No newline at end of file
+
+    stopped = true;
+    reader.join();
+    while (parsed.try_pop(command))
+        delete command;
+    source->close();
+}
+
+// Parses the whole script up to the first invalid line or EXIT, then lets the scheduler
+// run independent statements concurrently
+void Interpreter::run_in_parallel()
+{
+    vector<Command*> statements;
+    Command* invalid = nullptr;
+    Command* command;
+    while ((command = next_command()) != nullptr)
+    {
+        if (!command->is_correct() || command->code() == EXIT)
+        {
+            if (!command->is_correct())
+                invalid = command;
+            else
+                delete command;
+            break;
+        }
+        print_optimized(command);
+        statements.push_back(command);
+    }
+    source->close();
+
+    Scheduler scheduler(context, ThreadPool::shared(), true);
+    if (!scheduler.run(statements))
+        cout << "Error with running command!\n";
+    else if (invalid != nullptr)
+        invalid->run(context);
+    for (Command* command : statements)
+        delete command;
+    delete invalid;
+}
+// Assignments are only dispatched, so the prompt comes back while they are computed; other
+// commands wait for their result, and through the scheduler for the variables they read.
+// Before each prompt the finished statements are printed in program order, passing over
+// the assignments still running: their errors appear before a later prompt.
+void Interpreter::run_console_async()
+{
+    Scheduler scheduler(context, ThreadPool::shared(), false);
+    Command* command;
+    while ((command = next_command()) != nullptr)
+    {
+        if (command->code() == EXIT)
+        {
+            delete command;
+            break;
+        }
+        if (!command->is_correct())
+        {
+            scheduler.print(false);
+            command->run(context);
+            delete command;
+        }
+        else
+        {
+            int index = scheduler.add(command, optimized_text(command));
+            if (command->code() != ASSIGN)
+                scheduler.wait(index);
+            scheduler.print(false);
+        }
+        cout << "=> ";
+    }
+    scheduler.wait_all();
+    scheduler.print(false);
+}
+
+// Parses the script line by line while the scheduler runs the statements parsed so far, and
+// prints the ones finished in program order after each line. Parsing stops at a failed
+// statement; an invalid line or EXIT ends the script once everything before it has run.
+void Interpreter::run_async()
+{
+    Scheduler scheduler(context, ThreadPool::shared(), true);
+    Command* last = nullptr;
+    Command* command;
+    bool succeeded = true;
+    while (succeeded && (command = next_command()) != nullptr)
+    {
+        if (!command->is_correct() || command->code() == EXIT)
+        {
+            last = command;
+            break;
+        }
+        scheduler.add(command, optimized_text(command));
+        succeeded = scheduler.print(true);
+    }
+    source->close();
+
+    scheduler.wait_all();
+    if (succeeded)
+        succeeded = scheduler.print(true);
+    if (!succeeded)
+        cout << "Error with running command!\n";
+    else if (last != nullptr && !last->is_correct())
+        last->run(context);
+    delete last;
+}
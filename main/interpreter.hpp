@@ -1,19 +1,43 @@
 #pragma once
-#include <fstream>
 #include "../execution/context.hpp"
+#include "../execution/output_buffer.hpp"
 #include "../parsing/parser.hpp"
 
 struct Interpreter
 {
-    Interpreter();
-    explicit Interpreter(char const* path);
+    static const std::size_t PIPELINE_DEPTH;
+
+    struct Options
+    {
+        bool print_optimized;
+        bool lazy;
+        std::size_t cache_budget;
+        bool parallel;
+        bool summary;
+        bool stats;
+        const char* trace;
+        std::size_t memory_budget;
+        bool async;
+    };
+
+    explicit Interpreter(Options options);
+    Interpreter(char const* path, Options options);
     ~Interpreter();
     void run();
 private:
     void run_from_console();
     void run_from_file();
+    void run_pipelined();
+    void run_in_parallel();
+    void run_console_async();
+    void run_async();
+    std::string optimized_text(Command* command) const;
+    void print_optimized(Command* command);
+    Command* next_command();
 
+    OutputBuffer output;
     bool from_file;
-    std::ifstream* file;
+    SourceReader* source;
     Context* context;
-};
\ No newline at end of file
+    Options options;
+};
@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "../execution/profiler.hpp"
+#include "../execution/tracer.hpp"
+#include "server.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SERVER_SOCKETS
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// ==== Server implementation ====
+
+const size_t Server::READ_SIZE = 64 * 1024;
+const int Server::POLL_TIMEOUT_MS = 200;
+
+Server::Server(const char* socket_path, Interpreter::Options options) :
+    socket_path(socket_path), options(options), listener(-1), workers(nullptr),
+    sessions(unordered_map<int, shared_ptr<Session>>()), chunk(vector<char>(READ_SIZE))
+{}
+
+Server::~Server()
+{
+    delete workers;
+}
+
+#ifdef SERVER_SOCKETS
+
+static const char BANNER[] = "<===| Simple math interpreter |===>\n=> ";
+static const char PROMPT[] = "=> ";
+static const char CONTINUATION_PROMPT[] = "... ";
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int)
+{
+    stop_requested = 1;
+}
+
+// Same rule as parse_command: the first '=' outside quotes ends the line
+static bool needs_continuation(string_view line)
+{
+    string_view::size_type eq_pos = line.find('=');
+    if (eq_pos == string_view::npos || line.find('"') < eq_pos)
+        return false;
+    return line.find_first_not_of(" \t\r", eq_pos + 1) == string_view::npos;
+}
+
+// Length of the complete lines at the start of input that can be run now: an assignment
+// without its expression is held back until the line with the expression arrives, a repeat
+// block until its closing line
+static size_t runnable_length(const string& input, bool& waits_for_continuation)
+{
+    size_t position = 0;
+    waits_for_continuation = false;
+    while (true)
+    {
+        size_t end = input.find('\n', position);
+        if (end == string::npos)
+            return position;
+        string_view line = string_view(input).substr(position, end - position);
+        if (opens_block(line))
+        {
+            for (int depth = 1; depth != 0; )
+            {
+                size_t next_end = input.find('\n', end + 1);
+                if (next_end == string::npos)
+                {
+                    waits_for_continuation = true;
+                    return position;
+                }
+                string_view body_line = string_view(input).substr(end + 1, next_end - end - 1);
+                if (opens_block(body_line))
+                    depth++;
+                else if (trim(body_line) == BLOCK_END_STRING)
+                    depth--;
+                end = next_end;
+            }
+        }
+        else if (needs_continuation(line))
+        {
+            size_t next_end = input.find('\n', end + 1);
+            if (next_end == string::npos)
+            {
+                waits_for_continuation = true;
+                return position;
+            }
+            end = next_end;
+        }
+        position = end + 1;
+    }
+}
+
+static bool send_all(int socket, string_view text)
+{
+    while (!text.empty())
+    {
+        ssize_t sent = send(socket, text.data(), text.size(), MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        text.remove_prefix(size_t(sent));
+    }
+    return true;
+}
+
+Server::Session::Session(int socket) :
+    socket(socket), context(new Context()), input(string()), lines(0), busy(false)
+{}
+
+Server::Session::~Session()
+{
+    delete context;
+    close(socket);
+}
+
+bool Server::listen_socket()
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        cerr << "Socket path " << socket_path << " is too long." << endl;
+        return false;
+    }
+    strcpy(address.sun_path, socket_path.c_str());
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        cerr << "Error with creating socket." << endl;
+        return false;
+    }
+    // A socket file left by a previous server that did not stop cleanly
+    unlink(socket_path.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+    {
+        cerr << "Error with listening on " << socket_path << ": " << strerror(errno) << endl;
+        close(listener);
+        listener = -1;
+        return false;
+    }
+    return true;
+}
+
+void Server::accept_session()
+{
+    int socket = accept(listener, nullptr, nullptr);
+    if (socket < 0)
+        return;
+    auto session = make_shared<Session>(socket);
+    session->context->set_lazy(options.lazy);
+    session->context->result_cache().set_budget(options.cache_budget);
+    session->context->set_summary(options.summary);
+    session->context->set_memory_budget(options.memory_budget);
+    if (send_all(socket, BANNER))
+        sessions.emplace(socket, session);
+}
+
+// Appends received bytes to the session and hands it to a worker unless one already runs it
+void Server::receive(int socket)
+{
+    auto found = sessions.find(socket);
+    if (found == sessions.end())
+        return;
+    ssize_t count = recv(socket, chunk.data(), chunk.size(), 0);
+    if (count < 0 && errno == EINTR)
+        return;
+    if (count <= 0)
+    {
+        // A running worker keeps the session alive until it is done with it
+        sessions.erase(found);
+        return;
+    }
+
+    shared_ptr<Session> session = found->second;
+    lock_guard<mutex> guard(session->lock);
+    session->input.append(chunk.data(), size_t(count));
+    if (!session->busy && memchr(chunk.data(), '\n', size_t(count)) != nullptr)
+    {
+        session->busy = true;
+        workers->submit([this, session] { serve(session); });
+    }
+}
+
+// Runs batches of received lines until the session has nothing runnable left
+void Server::serve(const shared_ptr<Session>& session)
+{
+    while (true)
+    {
+        string batch;
+        {
+            lock_guard<mutex> guard(session->lock);
+            bool waits_for_continuation;
+            size_t length = runnable_length(session->input, waits_for_continuation);
+            if (length == 0)
+            {
+                // Runs once per received line, like the prompt of the console
+                if (waits_for_continuation)
+                    send_all(session->socket, CONTINUATION_PROMPT);
+                session->busy = false;
+                return;
+            }
+            batch = session->input.substr(0, length);
+            session->input.erase(0, length);
+        }
+
+        string reply;
+        bool open = execute(*session, batch, reply);
+        if (!send_all(session->socket, reply) || !open)
+        {
+            // The polling thread sees the end of the stream and drops the session
+            shutdown(session->socket, SHUT_RDWR);
+            lock_guard<mutex> guard(session->lock);
+            session->input.clear();
+            session->busy = false;
+            return;
+        }
+    }
+}
+
+// Runs the commands of one batch in the session's context, collecting everything they
+// print together with the prompts. Returns false once the client asked to exit.
+bool Server::execute(Session& session, string_view batch, string& reply)
+{
+    ostringstream output;
+    Context::Redirect redirect(&output, &output);
+    SourceReader source(batch);
+    string_view command_string;
+    bool open = true;
+    while (open && source.next_line(command_string))
+    {
+        int line = session.lines + source.line_number();
+        Command* command;
+        {
+            Tracer::Span span("parse", "parse");
+            if (span.recording())
+            {
+                span.set_name("parse line " + to_string(line));
+                span.add_argument("line", line);
+            }
+            command = parse_command(command_string, source);
+        }
+        command->set_line(line);
+        if (command->code() == EXIT)
+            open = false;
+        else
+        {
+            if (options.print_optimized && command->is_correct() && !command->to_string().empty())
+                output << "~> " << command->to_string() << '\n';
+            command->execute(session.context);
+            session.context->enforce_budget();
+            output << PROMPT;
+        }
+        delete command;
+    }
+    session.lines += source.line_number();
+    reply = output.str();
+    return open;
+}
+
+void Server::run()
+{
+    if (!listen_socket())
+        return;
+    if (options.trace != nullptr && !Tracer::open(options.trace))
+        cerr << "Error with opening trace file " << options.trace << ". Tracing is off." << endl;
+
+    struct sigaction action = {};
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    workers = new ThreadPool(max(2u, thread::hardware_concurrency()));
+    cout << "Serving on " << socket_path << " with " << workers->size() << " workers" << endl;
+
+    vector<pollfd> descriptors;
+    while (!stop_requested)
+    {
+        descriptors.clear();
+        descriptors.push_back(pollfd{listener, POLLIN, 0});
+        for (const auto& session : sessions)
+            descriptors.push_back(pollfd{session.first, POLLIN, 0});
+        int ready = poll(descriptors.data(), descriptors.size(), POLL_TIMEOUT_MS);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            cerr << "Error with polling sockets: " << strerror(errno) << endl;
+            break;
+        }
+        if (descriptors[0].revents != 0)
+            accept_session();
+        for (size_t i = 1; i != descriptors.size(); i++)
+            if (descriptors[i].revents != 0)
+                receive(descriptors[i].fd);
+    }
+
+    close(listener);
+    listener = -1;
+    unlink(socket_path.c_str());
+    for (const auto& session : sessions)
+        shutdown(session.first, SHUT_RDWR);
+    sessions.clear();
+    // Waits for the batches still running
+    delete workers;
+    workers = nullptr;
+
+    if (options.stats)
+        Profiler::print(cout);
+    if (Tracer::enabled() && !Tracer::close())
+        cerr << "Error with writing trace file " << options.trace << "." << endl;
+}
+
+#else
+
+Server::Session::Session(int socket) :
+    socket(socket), context(new Context()), input(string()), lines(0), busy(false)
+{}
+
+Server::Session::~Session()
+{
+    delete context;
+}
+
+void Server::run()
+{
+    cerr << "Server mode needs Unix domain sockets, which this platform does not provide." << endl;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "../execution/thread_pool.hpp"
+#include "interpreter.hpp"
+
+// ==== Server declaration ====
+
+// Serves interpreter sessions on a local Unix domain socket. Every connection gets its own
+// Context and speaks the console protocol: a banner, then the output of each received line
+// followed by the "=> " prompt ("... " while an assignment waits for its expression).
+// One thread polls the sockets and collects complete lines; the lines of a session are run
+// by the server's worker pool, never by two workers at once, while different sessions run
+// concurrently. The workers are separate from ThreadPool::shared, so a session never gets
+// picked up by a thread waiting inside another session's parallel kernel.
+
+struct Server
+{
+    static const std::size_t READ_SIZE;
+    static const int POLL_TIMEOUT_MS;
+
+    Server(const char* socket_path, Interpreter::Options options);
+    ~Server();
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Serves until SIGINT or SIGTERM
+    void run();
+private:
+    struct Session
+    {
+        explicit Session(int socket);
+        ~Session();
+
+        int socket;
+        Context* context;
+        std::mutex lock;
+        std::string input;
+        int lines;
+        bool busy;
+    };
+
+    bool listen_socket();
+    void accept_session();
+    void receive(int socket);
+    void serve(const std::shared_ptr<Session>& session);
+    bool execute(Session& session, std::string_view batch, std::string& reply);
+
+    std::string socket_path;
+    Interpreter::Options options;
+    int listener;
+    ThreadPool* workers;
+    std::unordered_map<int, std::shared_ptr<Session>> sessions;
+    std::vector<char> chunk;
+};
@@ -1,20 +1,78 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
 #include "interpreter.hpp"
+#include "../execution/kernel_registry.hpp"
+#include "server.hpp"
 
 // Project build from math_interpreter root directory:
-// c++ parsing/*.cpp types/*.cpp execution/*.cpp main/*.cpp -o interpreter.exe
+// c++ -rdynamic parsing/*.cpp types/*.cpp execution/*.cpp main/*.cpp -o interpreter.exe
+//
+// Usage: interpreter.exe [--print-optimized] [--lazy] [--parallel] [--summary] [--stats] [--cache-budget bytes] [--trace file]
+//                        [--memory-budget bytes] [--plugin file]... [--async] [script]
+//        interpreter.exe --serve socket_path [options]
+// --parallel runs independent statements of a script concurrently; it has no effect together with --lazy
+// --summary prints only the shape and corner elements of matrices larger than 6x6
+// --stats prints the profiling counters at exit; they are only collected in a build with -DMATH_PROFILE
+// --serve runs a session with its own variables for every client of a local Unix socket until SIGINT/SIGTERM
+// --trace writes parse, statement and kernel spans in Chrome trace format (chrome://tracing, Perfetto)
+// --memory-budget spills the least recently read matrices to a temporary file while variables hold more bytes
+// --plugin loads a shared object registering kernels callable in expressions, see execution/kernel_registry.hpp
+// --async lets later statements run while earlier ones are computed, waiting only for outputs and the variables
+//         they read; results are still printed in program order. It has no effect together with --lazy
 
 int main(int argc, char const* argv[])
 {
-    if (argc > 1)
+    Interpreter::Options options = {false, false, ResultCache::DEFAULT_BUDGET, false, false, false, nullptr, 0, false};
+    char const* path = nullptr;
+    char const* socket_path = nullptr;
+    for (int i = 1; i < argc; i++)
     {
-        Interpreter interpreter(argv[1]);
+        if (strcmp(argv[i], "--print-optimized") == 0)
+            options.print_optimized = true;
+        else if (strcmp(argv[i], "--lazy") == 0)
+            options.lazy = true;
+        else if (strcmp(argv[i], "--parallel") == 0)
+            options.parallel = true;
+        else if (strcmp(argv[i], "--async") == 0)
+            options.async = true;
+        else if (strcmp(argv[i], "--summary") == 0)
+            options.summary = true;
+        else if (strcmp(argv[i], "--stats") == 0)
+            options.stats = true;
+        else if (strcmp(argv[i], "--cache-budget") == 0 && i + 1 < argc)
+            options.cache_budget = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            options.trace = argv[++i];
+        else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc)
+            options.memory_budget = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            socket_path = argv[++i];
+        else if (strcmp(argv[i], "--plugin") == 0 && i + 1 < argc)
+        {
+            std::string error;
+            if (!KernelRegistry::shared().load_plugin(argv[++i], error))
+                std::cerr << "Error with loading plugin " << argv[i] << ": " << error << std::endl;
+        }
+        else
+            path = argv[i];
+    }
+
+    if (socket_path != nullptr)
+    {
+        Server server(socket_path, options);
+        server.run();
+    }
+    else if (path != nullptr)
+    {
+        Interpreter interpreter(path, options);
         interpreter.run();
     }
     else
     {
-        Interpreter interpreter;
+        Interpreter interpreter(options);
         interpreter.run();
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,7 +1,10 @@
 #pragma once
+#include <memory>
 #include <string>
 #include <vector>
 
+struct GenericValue;
+
 enum ExpressionType
 {
     UNRECOGNIZED,
@@ -17,26 +20,56 @@ enum TokenType
     TOKEN_MATRIX,
     TOKEN_RATIONAL,
     TOKEN_UNARY,
-    TOKEN_BINARY
+    TOKEN_BINARY,
+    TOKEN_IMPORT,
+    TOKEN_PARAMETER,
+    TOKEN_CALL
 };
 
+// Literal tokens carry the value built from their text once at parse time, together with an
+// id unique to that value which copies of the token share. Import tokens
+// (read_csv and read_bin calls) are leaves too, but read their file on every evaluation.
+// In the body of a user function its parameter is a parameter token, resolved once when
+// the function is defined, so a call reads its argument without a name lookup.
+// Calls with one argument are unary tokens, calls with more are call tokens with an arity.
+// A variable token bound to a slot is read through the slots of the repeat body it belongs to.
 struct Token
 {
     Token(TokenType t, std::string v);
+    Token(TokenType t, std::string v, std::shared_ptr<GenericValue> constant);
+    Token(TokenType t, std::string v, int arity);
     Token() = default;
-    inline TokenType get_type() { return type; }
-    inline std::string get_value() { return value; }
+    inline TokenType get_type() const { return type; }
+    inline const std::string& get_value() const { return value; }
+    inline GenericValue* get_constant() const { return constant.get(); }
+    inline unsigned long get_constant_id() const { return constant_id; }
+    inline int get_arity() const { return arity; }
+    inline int get_slot() const { return slot; }
+    inline Token with_slot(int index) const { Token token = *this; token.slot = index; return token; }
 private:
     TokenType type;
     std::string value;
+    std::shared_ptr<GenericValue> constant;
+    unsigned long constant_id = 0;
+    int arity = 1;
+    int slot = -1;
 };
 
+// Tokens are stored in prefix order: every operator is followed by its operands,
+// so nested expressions stay a flat sequence
 struct Expression
 {
     Expression(bool correct, ExpressionType type, std::vector<Token> parts);
     inline bool is_correct() const { return correct; }
-    inline ExpressionType get_type() { return type; }
-    Token inline operator[](int i) { return parts[i]; }
+    inline ExpressionType get_type() const { return type; }
+    inline const Token& operator[](int i) const { return parts[i]; }
+    inline int size() const { return int(parts.size()); }
+    inline const std::vector<Token>& tokens() const { return parts; }
+    int subexpression_end(int position) const;
+    std::vector<std::string> variable_names() const;
+    // Distinct user functions called, i.e. unary calls no kernel is registered for
+    std::vector<std::string> function_names() const;
+    std::string to_string() const;
 private:
     bool correct;
     ExpressionType type;
@@ -0,0 +1,113 @@
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "../execution/kernel_registry.hpp"
+
+using namespace std;
+
+bool is_constant(const vector<Token>& parts)
+{
+    return parts.size() == 1 && parts[0].get_constant() != nullptr;
+}
+
+bool is_scalar_one(const vector<Token>& parts)
+{
+    if (!is_constant(parts) || parts[0].get_constant()->get_type() != RATIONAL_NUMBER)
+        return false;
+    auto number = dynamic_cast<RationalNumber*>(parts[0].get_constant());
+    return number->num() == 1 && number->den() == 1;
+}
+
+// Wraps a folded value into a literal token whose text parses back to the same value
+Token constant_token(GenericValue* value)
+{
+    if (value->get_type() == RATIONAL_NUMBER)
+        return Token(TOKEN_RATIONAL, value->to_string(), shared_ptr<GenericValue>(value));
+
+    auto matrix = dynamic_cast<Matrix*>(value);
+    string text = "[";
+    for (int i = 0; i != matrix->rows(); i++)
+    {
+        if (i != 0)
+            text += "; ";
+        for (int j = 0; j != matrix->cols(); j++)
+            text += (j != 0 ? " " : "") + matrix->at(i, j).to_string();
+    }
+    text += "]";
+    return Token(TOKEN_MATRIX, text, shared_ptr<GenericValue>(value));
+}
+
+// Kernels keep no state, so a call on a constant is computed once here; in-place kernels
+// are left alone, since they would write into the constant
+bool fold_unary(const string& function, GenericValue* argument, GenericValue** result)
+{
+    const Kernel* kernel = KernelRegistry::shared().find(function, 1);
+    GenericValue* arguments[] = {argument};
+    return kernel != nullptr && kernel->function != nullptr && kernel->accepts(arguments)
+        && kernel->function(arguments, result);
+}
+
+vector<Token> simplify(const vector<Token>& parts, int& position)
+{
+    const Token& token = parts[position++];
+    if (token.get_type() == TOKEN_UNARY)
+    {
+        vector<Token> argument = simplify(parts, position);
+        const string& function = token.get_value();
+
+        // -(-x) is x for numbers and matrices alike. T(T(x)) is not cancelled: T rejects
+        // numbers, and whether x is a matrix is only known once it is evaluated.
+        if (argument[0].get_type() == TOKEN_UNARY && function == "-" && argument[0].get_value() == "-")
+            return vector<Token>(argument.begin() + 1, argument.end());
+
+        GenericValue* folded = nullptr;
+        if (is_constant(argument) && fold_unary(function, argument[0].get_constant(), &folded) && folded != nullptr)
+            return vector<Token>{constant_token(folded)};
+
+        argument.insert(argument.begin(), token);
+        return argument;
+    }
+    else if (token.get_type() == TOKEN_BINARY)
+    {
+        vector<Token> left = simplify(parts, position);
+        vector<Token> right = simplify(parts, position);
+        char op = token.get_value()[0];
+
+        GenericValue* folded = nullptr;
+        if (is_constant(left) && is_constant(right)
+                && binary_operation(token.get_value(), left[0].get_constant(), right[0].get_constant(), &folded))
+            return vector<Token>{constant_token(folded)};
+
+        // Multiplying by 1 is valid for numbers and matrices alike. Adding a zero matrix is
+        // kept: dropping it would hide the error for a number or a matrix of another shape.
+        if (op == '*' && is_scalar_one(right))
+            return left;
+        if (op == '*' && is_scalar_one(left))
+            return right;
+
+        vector<Token> result(1, token);
+        result.insert(result.end(), left.begin(), left.end());
+        result.insert(result.end(), right.begin(), right.end());
+        return result;
+    }
+    else if (token.get_type() == TOKEN_CALL)
+    {
+        vector<Token> result(1, token);
+        for (int i = 0; i != token.get_arity(); i++)
+        {
+            vector<Token> argument = simplify(parts, position);
+            result.insert(result.end(), argument.begin(), argument.end());
+        }
+        return result;
+    }
+    return vector<Token>(1, token);
+}
+
+Expression optimize_expression(const Expression& expression)
+{
+    if (!expression.is_correct() || expression.size() == 0)
+        return expression;
+    int position = 0;
+    vector<Token> parts = simplify(expression.tokens(), position);
+    ExpressionType type = expression_type(parts[0]);
+    return Expression(true, type, parts);
+}
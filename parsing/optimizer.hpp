@@ -0,0 +1,7 @@
+#pragma once
+#include "expression.hpp"
+
+// Simplifies a parsed expression once so that every execution of it does less work:
+// literal-only subexpressions are folded into constants, -(-x) cancels out and
+// multiplications by 1 are dropped.
+Expression optimize_expression(const Expression& expression);
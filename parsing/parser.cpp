@@ -1,5 +1,11 @@
+#include <atomic>
+#include <algorithm>
 #include <iostream>
+#include "optimizer.hpp"
 #include "parser.hpp"
+#include "../execution/kernel_registry.hpp"
+#include "../execution/profiler.hpp"
+#include "../types/matrix_io.hpp"
 
 using namespace std;
 
@@ -11,163 +17,489 @@ string trim(string s)
     return s;
 }
 
+// Lines and literals are parsed as views into the source, so trimming copies nothing
+string_view trim(string_view s)
+{
+    string_view::size_type first = s.find_first_not_of(" \t");
+    if (first == string_view::npos)
+        return string_view();
+    return s.substr(first, s.find_last_not_of(" \t") + 1 - first);
+}
+
+// Regex matches over views
+typedef match_results<string_view::const_iterator> view_match;
+
+static string_view submatch(string_view text, const view_match& match, int index)
+{
+    return text.substr(match.position(index), match.length(index));
+}
+
 Token::Token(TokenType t, string v) :
     type(t), value(std::move(v))
 {}
 
+// Sessions of the server parse concurrently
+static atomic<unsigned long> last_constant_id(0);
+
+Token::Token(TokenType t, string v, shared_ptr<GenericValue> constant) :
+    type(t), value(std::move(v)), constant(std::move(constant)), constant_id(++last_constant_id)
+{}
+
+Token::Token(TokenType t, string v, int arity) :
+    type(t), value(std::move(v)), arity(arity)
+{}
+
+Token literal_token(TokenType type, string_view text)
+{
+    if (type == TOKEN_RATIONAL)
+        return Token(type, string(text), shared_ptr<GenericValue>(new RationalNumber(string(text))));
+    else
+        return Token(type, string(text), shared_ptr<GenericValue>(new Matrix(text)));
+}
+
 const string VAR_NAME_REG_EXP_STR = "[a-zA-Z_]\\w*";
 const regex VAR_NAME_REG_EXP = regex(VAR_NAME_REG_EXP_STR);
-const regex UNARY_REG_EXP = regex( VAR_NAME_REG_EXP_STR + R"(\([^\(\)]+\))");
-const regex BINARY_OPERATOR_REG_EXP = regex("[*+-/]");
+const regex UNARY_CALL_REG_EXP = regex("^" + VAR_NAME_REG_EXP_STR + R"(\s*\()");
+const string BINARY_OPERATORS = "+-*/";
 const string EXIT_STRING = "EXIT";
+const string ALLOC_STATS_STRING = ":alloc";
+const string CACHE_STATS_STRING = ":cache";
+const string CACHE_CLEAR_STRING = ":cache clear";
+const string PROFILE_STATS_STRING = ":stats";
+const string MEMORY_STATS_STRING = ":mem";
+const regex EXPORT_REG_EXP = regex(R"re(^(write_csv|write_bin)\s*\((.*),\s*"([^"]*)"\s*\)$)re");
+const regex WORKSPACE_REG_EXP = regex(R"re(^(save|load)\s+"([^"]*)"$)re");
+const regex REPEAT_REG_EXP = regex(R"(^repeat\s+(\d+)\s*\{(.*)$)");
+const regex FUNCTION_REG_EXP = regex(R"(^def\s+()" + VAR_NAME_REG_EXP_STR + R"()\s*\(\s*()" + VAR_NAME_REG_EXP_STR
+                                      + R"()\s*\)\s*=(.*)$)");
+const string BLOCK_END_STRING = "}";
 
 Expression::Expression(bool correct, ExpressionType type, vector<Token> parts) :
         correct(correct), type(type), parts(std::move(parts))
 {}
 
-bool is_correct_var_name(const string& var_name)
+// Position just past the subexpression that starts at position
+int Expression::subexpression_end(int position) const
+{
+    int pending = 1;
+    while (pending != 0)
+    {
+        TokenType token_type = parts[position++].get_type();
+        if (token_type == TOKEN_BINARY)
+            pending++;
+        else if (token_type == TOKEN_CALL)
+            pending += parts[position - 1].get_arity() - 1;
+        else if (token_type != TOKEN_UNARY)
+            pending--;
+    }
+    return position;
+}
+
+// Distinct variables read by the expression, in order of first appearance
+vector<string> Expression::variable_names() const
 {
-    smatch var_name_match;
-    return (regex_match(var_name, var_name_match, VAR_NAME_REG_EXP) && var_name != Context::TEMP_VAR);
+    vector<string> names;
+    for (const Token& token : parts)
+        if (token.get_type() == TOKEN_VARIABLE && find(names.begin(), names.end(), token.get_value()) == names.end())
+            names.push_back(token.get_value());
+    return names;
 }
 
-Expression parse_expression(string expression)
+vector<string> Expression::function_names() const
 {
-    smatch binary_operator_match, unary_match;
-    string expression_copy = expression;
+    vector<string> names;
+    for (const Token& token : parts)
+        if (token.get_type() == TOKEN_UNARY && KernelRegistry::shared().find(token.get_value(), 1) == nullptr
+                && find(names.begin(), names.end(), token.get_value()) == names.end())
+            names.push_back(token.get_value());
+    return names;
+}
+
+string subexpression_to_string(const vector<Token>& parts, int& position, bool nested)
+{
+    const Token& token = parts[position++];
+    if (token.get_type() == TOKEN_UNARY)
+    {
+        bool simple_argument = parts[position].get_type() != TOKEN_UNARY && parts[position].get_type() != TOKEN_BINARY;
+        string argument = subexpression_to_string(parts, position, false);
+        if (token.get_value() == "-")
+            return simple_argument ? "-" + argument : "-(" + argument + ")";
+        return token.get_value() + "(" + argument + ")";
+    }
+    else if (token.get_type() == TOKEN_CALL)
+    {
+        string arguments;
+        for (int i = 0; i != token.get_arity(); i++)
+            arguments += (i != 0 ? ", " : "") + subexpression_to_string(parts, position, false);
+        return token.get_value() + "(" + arguments + ")";
+    }
+    else if (token.get_type() == TOKEN_BINARY)
+    {
+        string left = subexpression_to_string(parts, position, true);
+        string right = subexpression_to_string(parts, position, true);
+        string result = left + " " + token.get_value() + " " + right;
+        return nested ? "(" + result + ")" : result;
+    }
+    else
+        return token.get_value();
+}
+
+string Expression::to_string() const
+{
+    if (parts.empty())
+        return string();
+    int position = 0;
+    return subexpression_to_string(parts, position, false);
+}
+
+bool is_correct_var_name(string_view var_name)
+{
+    return (regex_match(var_name.begin(), var_name.end(), VAR_NAME_REG_EXP) && var_name != Context::TEMP_VAR);
+}
+
+// Finds the binary operator the expression has to be split at: the rightmost one
+// outside of brackets among the lowest precedence level, so chains stay left-associative.
+// The element-wise .* and ./ share the level of * and / and are found at their dot.
+string::size_type find_split_operator(string_view expression)
+{
+    string::size_type additive = string::npos, multiplicative = string::npos;
+    int depth = 0;
+    bool after_operand = false, quoted = false;
+    for (string::size_type i = 0; i != expression.size(); i++)
+    {
+        char c = expression[i];
+        if (c == '"')
+            quoted = !quoted;
+        if (quoted)
+            continue;
+        if (c == '(' || c == '[')
+            depth++;
+        else if (c == ')' || c == ']')
+            depth--;
+        else if (depth == 0 && BINARY_OPERATORS.find(c) != string::npos)
+        {
+            if (!after_operand)
+                continue;
+            if (c == '+' || c == '-')
+                additive = i;
+            else
+                multiplicative = (i != 0 && expression[i - 1] == '.') ? i - 1 : i;
+            after_operand = false;
+            continue;
+        }
+
+        if (c != ' ' && c != '\t')
+            after_operand = true;
+    }
+    return (additive != string::npos) ? additive : multiplicative;
+}
+
+// Position of the bracket closing the one opened at open_pos, or npos
+string::size_type find_closing_bracket(string_view expression, string::size_type open_pos)
+{
+    int depth = 0;
+    bool quoted = false;
+    for (string::size_type i = open_pos; i != expression.size(); i++)
+    {
+        if (expression[i] == '"')
+            quoted = !quoted;
+        if (quoted)
+            continue;
+        if (expression[i] == '(' || expression[i] == '[')
+            depth++;
+        else if ((expression[i] == ')' || expression[i] == ']') && --depth == 0)
+            return i;
+    }
+    return string::npos;
+}
+
+// Arguments of a call, split at the commas outside of brackets and quotes
+vector<string_view> split_arguments(string_view arguments)
+{
+    vector<string_view> parts;
+    string_view::size_type start = 0;
+    int depth = 0;
+    bool quoted = false;
+    for (string_view::size_type i = 0; i != arguments.size(); i++)
+    {
+        char c = arguments[i];
+        if (c == '"')
+            quoted = !quoted;
+        if (!quoted && (c == '(' || c == '['))
+            depth++;
+        else if (!quoted && (c == ')' || c == ']'))
+            depth--;
+        else if (!quoted && depth == 0 && c == ',')
+        {
+            parts.push_back(arguments.substr(start, i - start));
+            start = i + 1;
+        }
+    }
+    parts.push_back(arguments.substr(start));
+    return parts;
+}
+
+// Appends the expression to parts in prefix order: every operator token is followed by its operands
+bool parse_subexpression(string_view expression, vector<Token>& parts)
+{
+    expression = trim(expression);
+    if (expression.empty())
+        return false;
+
     if (is_correct_var_name(expression))
     {
-        vector<Token> parts(1);
-        parts[0] = Token(TOKEN_VARIABLE, expression);
-        return Expression(true, VARIABLE, parts);
+        parts.emplace_back(TOKEN_VARIABLE, string(expression));
+        return true;
     }
     else if (RationalNumber::is_correct_str(expression))
     {
-        vector<Token> parts(1);
-        parts[0] = Token(TOKEN_RATIONAL, expression);
-        return Expression(true, VALUE, parts);
+        parts.push_back(literal_token(TOKEN_RATIONAL, expression));
+        return true;
     }
     else if (Matrix::is_correct_str(expression))
     {
-        vector<Token> parts(1);
-        parts[0] = Token(TOKEN_MATRIX, expression);
-        return Expression(true, VALUE, parts);
+        parts.push_back(literal_token(TOKEN_MATRIX, expression));
+        return true;
     }
-    else if (expression[0] == '-' || regex_match(expression, unary_match, UNARY_REG_EXP))
+
+    view_match import_match;
+    if (regex_match(expression.begin(), expression.end(), import_match, IMPORT_CALL_REG_EXP))
     {
-        string unary_function, argument;
-        vector<Token> parts(2);
+        string call = import_match[1].str() + "(\"" + import_match[2].str() + "\"";
+        if (import_match[3].matched)
+            call += ", " + to_string(stoi(import_match[3])) + ", " + to_string(stoi(import_match[4]));
+        parts.emplace_back(TOKEN_IMPORT, call + ")");
+        return true;
+    }
 
-        if (expression[0] != '-')
-        {
-            string::size_type first_par_pos = expression.find('(');
-            unary_function = expression.substr(0, first_par_pos);
-            argument = expression.substr(first_par_pos + 1, expression.size() - first_par_pos - 2);
-        }
+    string::size_type op_pos = find_split_operator(expression);
+    if (op_pos != string::npos)
+    {
+        string::size_type op_length = (expression[op_pos] == '.') ? 2 : 1;
+        parts.emplace_back(TOKEN_BINARY, string(expression.substr(op_pos, op_length)));
+        return parse_subexpression(expression.substr(0, op_pos), parts)
+            && parse_subexpression(expression.substr(op_pos + op_length), parts);
+    }
+    else if (expression[0] == '-')
+    {
+        parts.emplace_back(TOKEN_UNARY, "-");
+        return parse_subexpression(expression.substr(1), parts);
+    }
+    else if (expression[0] == '(')
+    {
+        if (find_closing_bracket(expression, 0) != expression.size() - 1)
+            return false;
+        return parse_subexpression(expression.substr(1, expression.size() - 2), parts);
+    }
+
+    view_match unary_match;
+    if (regex_search(expression.begin(), expression.end(), unary_match, UNARY_CALL_REG_EXP))
+    {
+        string::size_type first_par_pos = unary_match.length(0) - 1;
+        if (find_closing_bracket(expression, first_par_pos) != expression.size() - 1)
+            return false;
+        string name(trim(expression.substr(0, first_par_pos)));
+        vector<string_view> arguments = split_arguments(expression.substr(first_par_pos + 1, expression.size() - first_par_pos - 2));
+        if (arguments.size() == 1)
+            parts.emplace_back(TOKEN_UNARY, name);
         else
+            parts.emplace_back(TOKEN_CALL, name, int(arguments.size()));
+        for (string_view argument : arguments)
+            if (!parse_subexpression(argument, parts))
+                return false;
+        return true;
+    }
+    return false;
+}
+
+ExpressionType expression_type(const Token& root)
+{
+    switch (root.get_type())
+    {
+        case TOKEN_VARIABLE:
+        case TOKEN_PARAMETER:
+            return VARIABLE;
+        case TOKEN_RATIONAL:
+        case TOKEN_MATRIX:
+        case TOKEN_IMPORT:
+            return VALUE;
+        case TOKEN_UNARY:
+        case TOKEN_CALL:
+            return UNARY;
+        default:
+            return BINARY;
+    }
+}
+
+Expression parse_expression(string_view expression)
+{
+    vector<Token> parts;
+    if (!parse_subexpression(expression, parts))
+        return Expression(false, UNRECOGNIZED, vector<Token>());
+    ExpressionType type = expression_type(parts[0]);
+    return Expression(true, type, parts);
+}
+
+// An empty right side of an assignment or a definition continues on the next line of the source.
+// Reading it may invalidate views into the current line.
+static void read_continuation(string_view& expression, SourceReader& source)
+{
+    if (!expression.empty())
+        return;
+    if (source.interactive())
+        cout << "... ";
+    string_view continuation;
+    if (source.next_line(continuation))
+        expression = trim(continuation);
+}
+
+// References to the parameter become parameter tokens
+static Expression with_parameter(const Expression& body, const string& parameter)
+{
+    if (!body.is_correct())
+        return body;
+    vector<Token> parts = body.tokens();
+    for (Token& token : parts)
+        if (token.get_type() == TOKEN_VARIABLE && token.get_value() == parameter)
+            token = Token(TOKEN_PARAMETER, parameter);
+    return Expression(true, expression_type(parts[0]), parts);
+}
+
+bool opens_block(string_view command_line)
+{
+    view_match repeat_match;
+    string_view command_string = trim(command_line);
+    return regex_match(command_string.begin(), command_string.end(), repeat_match, REPEAT_REG_EXP)
+        && trim(submatch(command_string, repeat_match, 2)).empty();
+}
+
+// The body of a repeat block is parsed here once: either the statement between the braces
+// or the lines up to the closing "}" line, where nested blocks read their own lines
+static Command* parse_repeat(const string& count, string_view rest, SourceReader& source)
+{
+    vector<Command*> body;
+    bool correct = count.size() <= 9;
+    if (!rest.empty())
+    {
+        correct = correct && rest.back() == '}';
+        if (correct)
         {
-            unary_function = "-";
-            argument = expression.substr(1);
+            rest.remove_suffix(1);
+            body.push_back(parse_command(rest, source));
+            body.back()->set_line(source.line_number());
         }
-        parts[0] = Token(TOKEN_UNARY, unary_function);
-
-        if (is_correct_var_name(argument))
-            parts[1] = Token(TOKEN_VARIABLE,  argument);
-        else if (RationalNumber::is_correct_str(argument))
-            parts[1] = Token(TOKEN_RATIONAL,  argument);
-        else if (Matrix::is_correct_str(argument))
-            parts[1] = Token(TOKEN_MATRIX, argument);
-        else
-            return Expression(false, UNARY, parts);
-        return Expression(true, UNARY, parts);
     }
-    else if (regex_search(expression_copy, binary_operator_match, BINARY_OPERATOR_REG_EXP))
+    else
     {
-        Token op(TOKEN_BINARY, binary_operator_match[0]);
-
-        string::size_type op_pos = binary_operator_match.position(0);
-        int matches_number = 1;
-        expression_copy = binary_operator_match.suffix().str();
-        while (regex_search(expression_copy, binary_operator_match, BINARY_OPERATOR_REG_EXP))
+        bool closed = false;
+        string_view line;
+        while (!closed)
         {
-            matches_number++;
-            expression_copy = binary_operator_match.suffix().str();
+            if (source.interactive())
+                cout << "... ";
+            if (!source.next_line(line))
+                break;
+            if (trim(line) == BLOCK_END_STRING)
+            {
+                closed = true;
+                break;
+            }
+            int line_number = source.line_number();
+            Command* command = parse_command(line, source);
+            command->set_line(line_number);
+            body.push_back(command);
         }
-        if (matches_number != 1)
-            return Expression(false, BINARY, vector<Token>());
-
-        string first_operand = trim(expression.substr(0, op_pos));
-        string second_operand = trim(expression.substr(op_pos + 1));
-
-        Token first, second;
-        if (is_correct_var_name(first_operand))
-            first = Token(TOKEN_VARIABLE, first_operand);
-        else if (RationalNumber::is_correct_str(first_operand))
-            first = Token(TOKEN_RATIONAL, first_operand);
-        else if (Matrix::is_correct_str(first_operand))
-            first = Token(TOKEN_MATRIX, first_operand);
-        else
-            return Expression(false, BINARY, vector<Token>());
-
-        if (is_correct_var_name(second_operand))
-            second = Token(TOKEN_VARIABLE, second_operand);
-        else if (RationalNumber::is_correct_str(second_operand))
-            second = Token(TOKEN_RATIONAL, second_operand);
-        else if (Matrix::is_correct_str(second_operand))
-            second = Token(TOKEN_MATRIX, second_operand);
-        else
-            return Expression(false, BINARY, vector<Token>());
+        correct = correct && closed;
+    }
 
-        vector<Token> parts(3);
-        parts[0] = op;
-        parts[1] = first;
-        parts[2] = second;
-        return Expression(true, BINARY, parts);
+    for (Command* command : body)
+        correct = correct && command->is_correct() && command->code() != EXIT;
+    if (!correct)
+    {
+        for (Command* command : body)
+            delete command;
+        return new InvalidCommand(REPEAT, "This repeat block has invalid syntax.");
     }
-    else
-        return Expression(false, UNRECOGNIZED, vector<Token>());
+    // Blank lines of the body have nothing to run
+    auto blank = remove_if(body.begin(), body.end(), [](Command* command) { return command->code() == EMPTY; });
+    for_each(blank, body.end(), [](Command* command) { delete command; });
+    body.erase(blank, body.end());
+    return new Repeat(stoi(count), body);
 }
 
-Command* parse_command(string command_string)
+// An assignment with an empty right side continues on the next line of the same source
+Command* parse_command(string_view command_line, SourceReader& source)
 {
-    command_string = trim(command_string);
+    PROFILE_SCOPE(PROFILE_PARSE);
+    PROFILE_COUNT(PROFILE_PARSE, command_line.size(), 0, 0);
+    string_view command_string = trim(command_line);
     if (command_string.empty())
         return new Command(true, EMPTY);
     else if (command_string == EXIT_STRING)
         return new Command(true, EXIT);
+    else if (command_string == ALLOC_STATS_STRING)
+        return new AllocatorStats();
+    else if (command_string == CACHE_STATS_STRING || command_string == CACHE_CLEAR_STRING)
+        return new CacheStats(command_string == CACHE_CLEAR_STRING);
+    else if (command_string == PROFILE_STATS_STRING)
+        return new ProfileStats();
+    else if (command_string == MEMORY_STATS_STRING)
+        return new MemoryStats();
+
+    view_match workspace_match;
+    if (regex_match(command_string.begin(), command_string.end(), workspace_match, WORKSPACE_REG_EXP))
+        return new WorkspaceCommand(workspace_match[1] == "save" ? SAVE : LOAD, workspace_match[2]);
+
+    view_match export_match;
+    if (regex_match(command_string.begin(), command_string.end(), export_match, EXPORT_REG_EXP))
+    {
+        Expression exp = optimize_expression(parse_expression(submatch(command_string, export_match, 2)));
+        if (!exp.is_correct())
+            return new InvalidCommand(EXPORT, "This export command has invalid syntax.");
+        return new Export(export_match[1] == "write_bin", exp, export_match[3]);
+    }
+
+    view_match repeat_match;
+    if (regex_match(command_string.begin(), command_string.end(), repeat_match, REPEAT_REG_EXP))
+        return parse_repeat(repeat_match[1], trim(submatch(command_string, repeat_match, 2)), source);
+
+    view_match function_match;
+    if (regex_match(command_string.begin(), command_string.end(), function_match, FUNCTION_REG_EXP))
+    {
+        string name = function_match[1], parameter = function_match[2];
+        string_view body = trim(submatch(command_string, function_match, 3));
+        read_continuation(body, source);
+        Expression exp = optimize_expression(with_parameter(parse_expression(body), parameter));
+        if (!exp.is_correct() || KernelRegistry::shared().find(name, 1) != nullptr)
+            return new InvalidCommand(DEFINE, "This function definition has invalid syntax.");
+        return new FunctionDefinition(name, parameter, exp);
+    }
 
     string::size_type eq_pos = command_string.find('=');
+    string::size_type quote_pos = command_string.find('"');
+    if (quote_pos < eq_pos)
+        eq_pos = string::npos;
     if (eq_pos != string::npos)
     {
-        string variable_name = command_string.substr(0, eq_pos);
-        variable_name = trim(variable_name);
-
-        string expression = command_string.substr(eq_pos + 1);
-        expression = trim(expression);
-        if (expression.empty())
-        {
-            cout << "... ";
-            getline(cin, expression);
-            expression = trim(expression);
-        }
+        string variable_name(trim(command_string.substr(0, eq_pos)));
+        string_view expression = trim(command_string.substr(eq_pos + 1));
+        read_continuation(expression, source);
 
-        Expression exp = parse_expression(expression);
+        Expression exp = optimize_expression(parse_expression(expression));
 
         if (!exp.is_correct())
         {
-            cerr << "This assignment has invalid syntax." << endl;
-            return new Command(false, ASSIGN);
+            return new InvalidCommand(ASSIGN, "This assignment has invalid syntax.");
         }
         else
             return new Assignment(true, variable_name, exp);
     }
     else
     {
-        Expression exp = parse_expression(command_string);
+        Expression exp = optimize_expression(parse_expression(command_string));
         if (!exp.is_correct())
         {
-            cerr << "This output command has invalid syntax." << endl;
-            return new Command(false, OUTPUT);
+            return new InvalidCommand(OUTPUT, "This output command has invalid syntax.");
         }
         else
             return new Output(true, exp);
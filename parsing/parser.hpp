@@ -1,14 +1,32 @@
 #pragma once
+#include <string_view>
 #include "../execution/commands.hpp"
+#include "source_reader.hpp"
 
 std::string trim(std::string s);
+std::string_view trim(std::string_view s);
 
 extern const std::string VAR_NAME_REG_EXP_STR;
 extern const std::regex VAR_NAME_REG_EXP;
-extern const std::regex UNARY_REG_EXP;
-extern const std::regex BINARY_OPERATOR_REG_EXP;
+extern const std::regex UNARY_CALL_REG_EXP;
+extern const std::string BINARY_OPERATORS;
 extern const std::string EXIT_STRING;
+extern const std::string ALLOC_STATS_STRING;
+extern const std::string CACHE_STATS_STRING;
+extern const std::string CACHE_CLEAR_STRING;
+extern const std::string PROFILE_STATS_STRING;
+extern const std::string MEMORY_STATS_STRING;
+extern const std::regex WORKSPACE_REG_EXP;
+extern const std::regex EXPORT_REG_EXP;
+extern const std::regex REPEAT_REG_EXP;
+extern const std::regex FUNCTION_REG_EXP;
+extern const std::string BLOCK_END_STRING;
 
-bool is_correct_var_name(const std::string& var_name);
-Command* parse_command(std::string command_string);
-Expression parse_expression(std::string expression);
\ No newline at end of file
+Token literal_token(TokenType type, std::string_view text);
+bool is_correct_var_name(std::string_view var_name);
+Command* parse_command(std::string_view command_line, SourceReader& source);
+// A line starting a multi-line repeat block, whose body ends with a "}" line
+bool opens_block(std::string_view command_line);
+Expression parse_expression(std::string_view expression);
+bool parse_subexpression(std::string_view expression, std::vector<Token>& parts);
+ExpressionType expression_type(const Token& root);
\ No newline at end of file
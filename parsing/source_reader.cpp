@@ -0,0 +1,79 @@
+#include <cstring>
+#include <fstream>
+#include "source_reader.hpp"
+
+using namespace std;
+
+// ==== Source reader implementation ====
+
+SourceReader::SourceReader(const char* path) :
+    mapping(new MappedFile(path, false)), text(string_view()), position(0), lines_read(0), stream(nullptr),
+    owns_stream(false), opened(mapping->good()), is_interactive(false), buffer(string())
+{
+    if (opened)
+    {
+        text = string_view(mapping->data(), mapping->size());
+        return;
+    }
+    // Pipes, devices and platforms without mmap are streamed
+    delete mapping;
+    mapping = nullptr;
+    stream = new ifstream(path);
+    owns_stream = true;
+    opened = stream->good();
+}
+
+SourceReader::SourceReader(istream& input) :
+    mapping(nullptr), text(string_view()), position(0), lines_read(0), stream(&input),
+    owns_stream(false), opened(true), is_interactive(true), buffer(string())
+{}
+
+SourceReader::SourceReader(string_view text) :
+    mapping(nullptr), text(text), position(0), lines_read(0), stream(nullptr),
+    owns_stream(false), opened(true), is_interactive(false), buffer(string())
+{}
+
+SourceReader::~SourceReader()
+{
+    close();
+}
+
+bool SourceReader::good() const { return opened; }
+
+bool SourceReader::interactive() const { return is_interactive; }
+
+bool SourceReader::next_line(string_view& line)
+{
+    if (stream != nullptr)
+    {
+        if (!getline(*stream, buffer))
+            return false;
+        line = buffer;
+        lines_read++;
+        return true;
+    }
+    if (position >= text.size())
+        return false;
+
+    const char* start = text.data() + position;
+    const void* newline = memchr(start, '\n', text.size() - position);
+    size_t length = newline != nullptr
+        ? static_cast<const char*>(newline) - start
+        : text.size() - position;
+    line = string_view(start, length);
+    position += length + 1;
+    lines_read++;
+    return true;
+}
+
+void SourceReader::close()
+{
+    delete mapping;
+    mapping = nullptr;
+    text = string_view();
+    position = 0;
+    if (owns_stream)
+        delete stream;
+    stream = nullptr;
+    owns_stream = false;
+}
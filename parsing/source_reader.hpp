@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <istream>
+#include <string>
+#include <string_view>
+#include "../execution/mapped_file.hpp"
+
+// ==== Source reader declaration ====
+
+// Line source for scripts. Regular files are memory-mapped and their lines are handed out
+// as views into the mapping; pipes, terminals and std::cin fall back to buffered getline,
+// in which case a view stays valid only until the next call to next_line. Text already in
+// memory (e.g. a batch received by the server) is read in place and must outlive the reader.
+
+struct SourceReader
+{
+    explicit SourceReader(const char* path);
+    explicit SourceReader(std::istream& input);
+    explicit SourceReader(std::string_view text);
+    ~SourceReader();
+    SourceReader(const SourceReader&) = delete;
+    SourceReader& operator=(const SourceReader&) = delete;
+
+    bool good() const;
+    bool interactive() const;
+    bool next_line(std::string_view& line);
+    // 1-based number of the line last returned by next_line
+    inline int line_number() const { return lines_read; }
+    void close();
+private:
+    MappedFile* mapping;
+    std::string_view text;
+    std::size_t position;
+    int lines_read;
+    std::istream* stream;
+    bool owns_stream;
+    bool opened;
+    bool is_interactive;
+    std::string buffer;
+};
@@ -0,0 +1,51 @@
+#include <algorithm>
+#include "../execution/kernel_registry.hpp"
+
+// Sample kernel plugin, built from math_interpreter root directory:
+// c++ -O2 -fPIC -shared plugins/sample_kernels.cpp -o sample_kernels.so
+// and loaded with interpreter.exe --plugin ./sample_kernels.so
+//
+// clamp(M, low, high) limits every element of M to [low, high] in place,
+// diag(M) is the column of the diagonal elements of M.
+
+static bool less(const RationalNumber& left, const RationalNumber& right)
+{
+    return (long long)left.num() * right.den() < (long long)right.num() * left.den();
+}
+
+static bool clamp(Matrix& target, GenericValue* const* arguments)
+{
+    auto low = static_cast<RationalNumber*>(arguments[0]);
+    auto high = static_cast<RationalNumber*>(arguments[1]);
+    if (less(*high, *low))
+        return false;
+    for (int i = 0; i != target.rows(); i++)
+        for (int j = 0; j != target.cols(); j++)
+        {
+            RationalNumber& element = target.at(i, j);
+            if (less(element, *low))
+                element = *low;
+            else if (less(*high, element))
+                element = *high;
+        }
+    return true;
+}
+
+static bool diag(GenericValue* const* arguments, GenericValue** result)
+{
+    auto matrix = static_cast<Matrix*>(arguments[0]);
+    int size = std::min(matrix->rows(), matrix->cols());
+    auto column = new Matrix(size, 1);
+    for (int i = 0; i != size; i++)
+        column->at(i, 0) = matrix->at(i, i);
+    *result = column;
+    return true;
+}
+
+extern "C" bool register_kernels(KernelRegistry& registry, int api_version)
+{
+    if (api_version != KernelRegistry::API_VERSION)
+        return false;
+    return registry.add_in_place("clamp", {PARAMETER_MATRIX, PARAMETER_SCALAR, PARAMETER_SCALAR}, clamp)
+        && registry.add("diag", {PARAMETER_MATRIX}, diag);
+}
@@ -0,0 +1,43 @@
+#include <iostream>
+#include <vector>
+#include "../api/engine.hpp"
+
+using namespace std;
+
+// Links against the library only: bound arrays are read again by every evaluation
+static bool expect(bool condition, const char* what)
+{
+    if (!condition)
+        cerr << "engine_check: " << what << endl;
+    return condition;
+}
+
+int main()
+{
+    Engine engine;
+    vector<int> numerators = {1, 2, 3, 4};
+    vector<int> denominators = {1, 1, 2, 1};
+    vector<int> integers = {1, 0, 0, 1};
+    bool passed = expect(engine.bind("A", numerators.data(), denominators.data(), 2, 2), "bind A")
+        && expect(engine.bind("I", integers.data(), nullptr, 2, 2), "bind I");
+
+    CompiledExpression expression = Engine::compile("A * I + A");
+    EvaluationResult result;
+    passed = passed && expect(expression.is_correct(), "compile")
+        && expect(engine.evaluate(expression, result), "evaluate")
+        && expect(result.type() == MATRIX && result.rows() == 2 && result.cols() == 2, "shape")
+        && expect(result.at(1, 0).num() == 3 && result.at(1, 0).den() == 1, "first value");
+
+    numerators[0] = 5;
+    integers[3] = 2;
+    passed = passed && expect(engine.evaluate(expression, result), "evaluate after update")
+        && expect(result.at(0, 0).num() == 10 && result.at(1, 1).num() == 12, "updated value");
+
+    denominators[1] = 0;
+    passed = passed && expect(!engine.evaluate(expression, result), "zero denominator rejected");
+
+    CompiledExpression sum = Engine::compile("sum(I)");
+    passed = passed && expect(engine.evaluate(sum, result), "evaluate without A")
+        && expect(result.type() == RATIONAL_NUMBER && result.scalar().num() == 3, "sum");
+    return passed ? 0 : 1;
+}
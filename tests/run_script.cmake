@@ -0,0 +1,50 @@
+# Runs one script through the interpreter in one mode and compares what it prints.
+# Expects INTERPRETER, SCRIPT, MODE (eager, lazy, parallel, async or uncached) and WORK_DIR.
+# The output must match <script>.<mode>.expected if that file exists, otherwise
+# <script>.expected, so every mode is held to the eager output unless it differs by design.
+# Error messages are compared the same way against .errors files, or must be empty.
+
+if(MODE STREQUAL "lazy")
+    set(flags --lazy)
+elseif(MODE STREQUAL "parallel")
+    set(flags --parallel)
+elseif(MODE STREQUAL "async")
+    set(flags --async)
+elseif(MODE STREQUAL "uncached")
+    set(flags --cache-budget 0)
+else()
+    set(flags)
+endif()
+
+get_filename_component(directory "${SCRIPT}" DIRECTORY)
+get_filename_component(name "${SCRIPT}" NAME_WE)
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+execute_process(COMMAND "${INTERPRETER}" ${flags} "${SCRIPT}"
+                WORKING_DIRECTORY "${WORK_DIR}"
+                OUTPUT_VARIABLE output
+                ERROR_VARIABLE errors
+                RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${name} (${MODE}) exited with ${result}\n${errors}")
+endif()
+
+function(compare stream actual)
+    set(expected_path "${directory}/${name}.${MODE}.${stream}")
+    if(NOT EXISTS "${expected_path}")
+        set(expected_path "${directory}/${name}.${stream}")
+    endif()
+    set(expected "")
+    if(EXISTS "${expected_path}")
+        file(READ "${expected_path}" expected)
+    endif()
+    if(NOT actual STREQUAL expected)
+        file(WRITE "${WORK_DIR}/${name}.${stream}" "${actual}")
+        message(FATAL_ERROR "${name} (${MODE}): ${stream} differs from ${expected_path}, "
+                            "see ${WORK_DIR}/${name}.${stream}\n${actual}")
+    endif()
+endfunction()
+
+compare(expected "${output}")
+compare(errors "${errors}")
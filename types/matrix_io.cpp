@@ -0,0 +1,257 @@
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include "../execution/mapped_file.hpp"
+#include "../execution/thread_pool.hpp"
+#include "matrix_io.hpp"
+
+using namespace std;
+
+// ==== Matrix file import implementation ====
+
+const size_t PARALLEL_IMPORT_SIZE = 1 << 20;
+const regex IMPORT_CALL_REG_EXP = regex(
+        R"re(^(read_csv|read_bin)\s*\(\s*"([^"]*)"\s*(?:,\s*(\d{1,9})\s*,\s*(\d{1,9})\s*)?\)$)re");
+
+// Pieces [0, bounds[1]), [bounds[1], bounds[2]) ... of about equal size, each ending after a newline
+static vector<size_t> split_at_lines(const char* text, size_t size)
+{
+    size_t pieces = (size < PARALLEL_IMPORT_SIZE) ? 1 : 4 * size_t(ThreadPool::shared().size());
+    vector<size_t> bounds(1, 0);
+    for (size_t i = 1; i < pieces; i++)
+    {
+        size_t position = max(bounds.back(), size * i / pieces);
+        const void* newline = memchr(text + position, '\n', size - position);
+        if (newline == nullptr)
+            break;
+        position = static_cast<const char*>(newline) - text + 1;
+        if (position > bounds.back())
+            bounds.push_back(position);
+    }
+    bounds.push_back(size);
+    return bounds;
+}
+
+// Runs body on every piece, in parallel when there is more than one
+static void for_each_piece(size_t pieces, const function<void(size_t)>& body)
+{
+    if (pieces == 1)
+        body(0);
+    else
+        ThreadPool::shared().parallel_for(pieces, body);
+}
+
+static bool is_blank_line(const char* begin, const char* end)
+{
+    return skip_blanks(begin, end) == end;
+}
+
+static const char* line_end(const char* begin, const char* end)
+{
+    const void* newline = memchr(begin, '\n', end - begin);
+    return newline != nullptr ? static_cast<const char*>(newline) : end;
+}
+
+// Parses one line of exactly cols elements into row; row may be null to only count them
+static bool parse_csv_line(const char* position, const char* end, RationalNumber* row, int& cols)
+{
+    int count = 0;
+    while (true)
+    {
+        int numerator, denominator;
+        position = skip_blanks(position, end);
+        if (!scan_rational(position, end, numerator, denominator))
+            return false;
+        position = skip_blanks(position, end);
+        if (row != nullptr)
+        {
+            if (count == cols)
+                return false;
+            row[count] = RationalNumber(numerator, denominator);
+        }
+        count++;
+        if (position == end)
+            break;
+        if (*position++ != ',')
+            return false;
+    }
+    if (row == nullptr)
+        cols = count;
+    return count == cols;
+}
+
+bool read_csv(const string& path, GenericValue** result)
+{
+    MappedFile file(path, true);
+    if (!file.good())
+        return false;
+    const char* text = file.data();
+    vector<size_t> bounds = split_at_lines(text, file.size());
+    size_t pieces = bounds.size() - 1;
+
+    // First pass: rows per piece, so every piece knows where its rows go
+    vector<int> first_row(pieces + 1, 0);
+    for_each_piece(pieces, [&](size_t piece)
+    {
+        int rows = 0;
+        const char* end = text + bounds[piece + 1];
+        for (const char* line = text + bounds[piece]; line < end; )
+        {
+            const char* next = line_end(line, end);
+            if (!is_blank_line(line, next))
+                rows++;
+            line = next + 1;
+        }
+        first_row[piece + 1] = rows;
+    });
+    for (size_t piece = 0; piece != pieces; piece++)
+        first_row[piece + 1] += first_row[piece];
+    int rows = first_row[pieces], cols = 0;
+    if (rows == 0)
+        return false;
+
+    const char* line = text;
+    const char* end = text + file.size();
+    while (is_blank_line(line, line_end(line, end)))
+        line = line_end(line, end) + 1;
+    if (!parse_csv_line(line, line_end(line, end), nullptr, cols))
+        return false;
+
+    Matrix* matrix = new Matrix(rows, cols);
+    atomic<bool> failed(false);
+    for_each_piece(pieces, [&](size_t piece)
+    {
+        int row = first_row[piece];
+        const char* piece_end = text + bounds[piece + 1];
+        for (const char* line = text + bounds[piece]; line < piece_end && !failed; )
+        {
+            const char* next = line_end(line, piece_end);
+            if (!is_blank_line(line, next) && !parse_csv_line(line, next, &matrix->at(row++, 0), cols))
+                failed = true;
+            line = next + 1;
+        }
+    });
+    if (failed)
+    {
+        delete matrix;
+        return false;
+    }
+    *result = matrix;
+    return true;
+}
+
+bool read_bin(const string& path, int rows, int cols, GenericValue** result)
+{
+    MappedFile file(path, true);
+    if (!file.good() || rows <= 0 || cols <= 0
+        || file.size() != 2 * uint64_t(rows) * uint64_t(cols) * sizeof(int32_t))
+        return false;
+
+    Matrix* matrix = new Matrix(rows, cols);
+    size_t pieces = (file.size() < PARALLEL_IMPORT_SIZE) ? 1
+        : min(size_t(rows), 4 * size_t(ThreadPool::shared().size()));
+    atomic<bool> failed(false);
+    for_each_piece(pieces, [&](size_t piece)
+    {
+        int first = int(rows * piece / pieces), last = int(rows * (piece + 1) / pieces);
+        int32_t pair[2];
+        for (int i = first; i != last; i++)
+            for (int j = 0; j != cols; j++)
+            {
+                memcpy(pair, file.data() + (size_t(i) * cols + j) * sizeof(pair), sizeof(pair));
+                if (pair[1] == 0)
+                {
+                    failed = true;
+                    return;
+                }
+                if (pair[1] < 0)
+                {
+                    pair[0] = -pair[0];
+                    pair[1] = -pair[1];
+                }
+                matrix->at(i, j) = RationalNumber(pair[0], pair[1]);
+            }
+    });
+    if (failed)
+    {
+        delete matrix;
+        return false;
+    }
+    *result = matrix;
+    return true;
+}
+
+bool import_matrix(const string& call, GenericValue** result)
+{
+    smatch call_match;
+    if (!regex_match(call, call_match, IMPORT_CALL_REG_EXP))
+        return false;
+    bool has_shape = call_match[3].matched;
+    if (call_match[1] == "read_csv")
+        return !has_shape && read_csv(call_match[2], result);
+    return has_shape && read_bin(call_match[2], stoi(call_match[3]), stoi(call_match[4]), result);
+}
+
+// ==== Matrix file export implementation ====
+
+const size_t EXPORT_BUFFER_SIZE = 1 << 20;
+
+// Calls write(element, last_in_row) for every element in row-major order
+template <typename Write>
+static void for_each_element(GenericValue* value, Write write)
+{
+    if (value->get_type() == RATIONAL_NUMBER)
+    {
+        write(*static_cast<RationalNumber*>(value), true);
+        return;
+    }
+    const Matrix& matrix = *static_cast<Matrix*>(value);
+    for (int i = 0; i != matrix.rows(); i++)
+        for (int j = 0; j != matrix.cols(); j++)
+            write(matrix.at(i, j), j + 1 == matrix.cols());
+}
+
+bool write_csv(GenericValue* value, const string& path)
+{
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file.good())
+        return false;
+    vector<char> buffer(EXPORT_BUFFER_SIZE);
+    size_t used = 0;
+    for_each_element(value, [&](const RationalNumber& number, bool last_in_row)
+    {
+        if (used + RationalNumber::TEXT_SIZE + 1 > buffer.size())
+        {
+            file.write(buffer.data(), used);
+            used = 0;
+        }
+        used += number.format(buffer.data() + used);
+        buffer[used++] = last_in_row ? '\n' : ',';
+    });
+    file.write(buffer.data(), used);
+    file.flush();
+    return file.good();
+}
+
+bool write_bin(GenericValue* value, const string& path)
+{
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file.good())
+        return false;
+    vector<int32_t> buffer(EXPORT_BUFFER_SIZE / sizeof(int32_t));
+    size_t used = 0;
+    for_each_element(value, [&](const RationalNumber& number, bool)
+    {
+        if (used + 2 > buffer.size())
+        {
+            file.write(reinterpret_cast<const char*>(buffer.data()), used * sizeof(int32_t));
+            used = 0;
+        }
+        buffer[used++] = number.num();
+        buffer[used++] = number.den();
+    });
+    file.write(reinterpret_cast<const char*>(buffer.data()), used * sizeof(int32_t));
+    file.flush();
+    return file.good();
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <regex>
+#include <string>
+#include "var_types.hpp"
+
+// ==== Matrix file import declaration ====
+
+// read_csv("path") reads one matrix row per line, elements separated by commas and written as
+// integers or fractions; read_bin("path", rows, cols) reads row-major int32 numerator and
+// denominator pairs. Elements are parsed straight into the matrix storage, and files larger
+// than PARALLEL_IMPORT_SIZE are split at row boundaries and parsed on the shared thread pool.
+
+extern const std::size_t PARALLEL_IMPORT_SIZE;
+extern const std::regex IMPORT_CALL_REG_EXP;
+
+bool read_csv(const std::string& path, GenericValue** result);
+bool read_bin(const std::string& path, int rows, int cols, GenericValue** result);
+// Runs a call matched by IMPORT_CALL_REG_EXP
+bool import_matrix(const std::string& call, GenericValue** result);
+
+// ==== Matrix file export declaration ====
+
+// Counterparts of read_csv and read_bin, a rational number is written as a 1x1 matrix.
+// Elements are formatted from the matrix storage into an EXPORT_BUFFER_SIZE buffer
+// that is written out whenever it fills up.
+
+extern const std::size_t EXPORT_BUFFER_SIZE;
+
+bool write_csv(GenericValue* value, const std::string& path);
+bool write_bin(GenericValue* value, const std::string& path);
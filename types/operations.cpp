@@ -1,5 +1,29 @@
+#include "../execution/profiler.hpp"
+#include "../execution/tracer.hpp"
 #include "var_types.hpp"
 
+// Counts the elements and the allocation of a successful operation's result
+static inline bool profiled(bool succeeded, [[maybe_unused]] GenericValue** result)
+{
+#ifdef MATH_PROFILE
+    if (succeeded)
+    {
+        auto matrix = dynamic_cast<Matrix*>(*result);
+        PROFILE_COUNT(PROFILE_OPERATION, matrix != nullptr ? uint64_t(matrix->rows()) * matrix->cols() : 1, 1, 0);
+    }
+#endif
+    return succeeded;
+}
+
+// Operand shape shown in trace spans: "RxC" for matrices, "scalar" otherwise
+static std::string shape(GenericValue* value)
+{
+    if (value == nullptr || value->get_type() != MATRIX)
+        return "scalar";
+    auto matrix = static_cast<Matrix*>(value);
+    return std::to_string(matrix->rows()) + "x" + std::to_string(matrix->cols());
+}
+
 // ==== Binary operations implementation ====
 
 bool add(GenericValue* left, GenericValue* right, GenericValue** result)
@@ -111,25 +135,154 @@ bool divide(GenericValue* left, GenericValue* right, GenericValue** result)
         *result = new RationalNumber(*first / *second);
         return true;
     }
+    else if (left->get_type() == MATRIX)
+    {
+        // Dividing by a scalar is scaling by its reciprocal, which is exact for rationals
+        auto first = dynamic_cast<Matrix*>(left);
+        if (right->get_type() != RATIONAL_NUMBER)
+            return false;
+        auto second = dynamic_cast<RationalNumber*>(right);
+        if (second->num() == 0)
+            return false;
+        *result = new Matrix(*first * (RationalNumber(1, 1) / *second));
+        return true;
+    }
+    else
+        return false;
+}
+
+bool elementwise_multiply(GenericValue* left, GenericValue* right, GenericValue** result)
+{
+    if (left->get_type() != MATRIX || right->get_type() != MATRIX)
+        return multiply(left, right, result);
+    auto first = dynamic_cast<Matrix*>(left);
+    auto second = dynamic_cast<Matrix*>(right);
+    if (!first->has_same_size(*second))
+        return false;
+    *result = new Matrix(first->hadamard_product(*second));
+    return true;
+}
+
+bool elementwise_divide(GenericValue* left, GenericValue* right, GenericValue** result)
+{
+    if (left->get_type() != MATRIX || right->get_type() != MATRIX)
+        return divide(left, right, result);
+    auto first = dynamic_cast<Matrix*>(left);
+    auto second = dynamic_cast<Matrix*>(right);
+    if (!first->has_same_size(*second) || second->has_zero_element())
+        return false;
+    *result = new Matrix(first->hadamard_quotient(*second));
+    return true;
+}
+
+static const char* operation_name(const std::string& op)
+{
+    if (op == "+")
+        return "add";
+    else if (op == "-")
+        return "subtract";
+    else if (op == "*")
+        return "multiply";
+    else if (op == "/")
+        return "divide";
+    else if (op == ".*")
+        return "elementwise_multiply";
+    else
+        return "elementwise_divide";
+}
+
+bool binary_operation(const std::string& op, GenericValue* left, GenericValue* right, GenericValue** result)
+{
+    PROFILE_SCOPE(PROFILE_OPERATION);
+    Tracer::Span span("kernel", operation_name(op));
+    if (span.recording())
+    {
+        span.add_argument("left", shape(left));
+        span.add_argument("right", shape(right));
+    }
+    if (op == "+")
+        return profiled(add(left, right, result), result);
+    else if (op == "-")
+        return profiled(subtract(left, right, result), result);
+    else if (op == "*")
+        return profiled(multiply(left, right, result), result);
+    else if (op == "/")
+        return profiled(divide(left, right, result), result);
+    else if (op == ".*")
+        return profiled(elementwise_multiply(left, right, result), result);
+    else if (op == "./")
+        return profiled(elementwise_divide(left, right, result), result);
     else
         return false;
 }
 
+// ==== Fused operations implementation ====
+
+bool multiply_add(const RationalNumber& alpha, GenericValue* a, GenericValue* b,
+                  const RationalNumber& beta, GenericValue* c, GenericValue** result)
+{
+    PROFILE_SCOPE(PROFILE_OPERATION);
+    Tracer::Span span("kernel", "multiply_add");
+    if (span.recording())
+    {
+        span.add_argument("a", shape(a));
+        span.add_argument("b", shape(b));
+        if (c != nullptr)
+            span.add_argument("c", shape(c));
+    }
+    if (a->get_type() != MATRIX || b->get_type() != MATRIX || (c != nullptr && c->get_type() != MATRIX))
+        return false;
+    auto first = dynamic_cast<Matrix*>(a);
+    auto second = dynamic_cast<Matrix*>(b);
+    auto addend = dynamic_cast<Matrix*>(c);
+    if (!first->is_multipliable_with(*second))
+        return false;
+    if (addend != nullptr && (addend->rows() != first->rows() || addend->cols() != second->cols()))
+        return false;
+    *result = new Matrix(Matrix::multiply_add(alpha, *first, *second, beta, addend));
+    return profiled(true, result);
+}
+
+bool scaled_add(const RationalNumber& alpha, GenericValue* x,
+                const RationalNumber& beta, GenericValue* y, GenericValue** result)
+{
+    PROFILE_SCOPE(PROFILE_OPERATION);
+    Tracer::Span span("kernel", "scaled_add");
+    if (span.recording())
+        span.add_argument("x", shape(x));
+    if (x->get_type() != MATRIX || (y != nullptr && y->get_type() != MATRIX))
+        return false;
+    auto first = dynamic_cast<Matrix*>(x);
+    auto second = dynamic_cast<Matrix*>(y);
+    if (second != nullptr && !first->has_same_size(*second))
+        return false;
+    *result = new Matrix(Matrix::scaled_add(alpha, *first, beta, second));
+    return profiled(true, result);
+}
+
 // ==== Unary operations implementation ====
 
 bool T(GenericValue* argument, GenericValue** result)
 {
+    PROFILE_SCOPE(PROFILE_OPERATION);
+    Tracer::Span span("kernel", "transpose");
+    if (span.recording())
+        span.add_argument("argument", shape(argument));
     if (argument->get_type() != MATRIX)
         return false;
     auto matrix_argument = dynamic_cast<Matrix*>(argument);
     auto copy = new Matrix(*matrix_argument);
     copy->transpose();
     *result = copy;
-    return true;
+    return profiled(true, result);
 }
 
 bool unary_minus(GenericValue* argument, GenericValue** result)
 {
+    PROFILE_SCOPE(PROFILE_OPERATION);
+    Tracer::Span span("kernel", "negate");
+    if (span.recording())
+        span.add_argument("argument", shape(argument));
     if (argument->get_type() == MATRIX)
     {
         auto matrix_argument = dynamic_cast<Matrix*>(argument);
@@ -140,5 +293,61 @@ bool unary_minus(GenericValue* argument, GenericValue** result)
         auto rational_argument = dynamic_cast<RationalNumber*>(argument);
         *result = new RationalNumber(-(*rational_argument));
     }
-    return true;
+    return profiled(true, result);
+}
+
+// ==== Reductions implementation ====
+
+bool reduce_sum(GenericValue* argument, GenericValue** result)
+{
+    PROFILE_SCOPE(PROFILE_OPERATION);
+    Tracer::Span span("kernel", "sum");
+    if (span.recording())
+        span.add_argument("argument", shape(argument));
+    if (argument->get_type() != MATRIX)
+        return false;
+    *result = new RationalNumber(dynamic_cast<Matrix*>(argument)->sum());
+    return profiled(true, result);
+}
+
+bool reduce_trace(GenericValue* argument, GenericValue** result)
+{
+    PROFILE_SCOPE(PROFILE_OPERATION);
+    Tracer::Span span("kernel", "trace");
+    if (span.recording())
+        span.add_argument("argument", shape(argument));
+    if (argument->get_type() != MATRIX)
+        return false;
+    auto matrix = dynamic_cast<Matrix*>(argument);
+    if (matrix->rows() != matrix->cols())
+        return false;
+    *result = new RationalNumber(matrix->trace());
+    return profiled(true, result);
+}
+
+bool reduce_max(GenericValue* argument, GenericValue** result)
+{
+    PROFILE_SCOPE(PROFILE_OPERATION);
+    Tracer::Span span("kernel", "max");
+    if (span.recording())
+        span.add_argument("argument", shape(argument));
+    if (argument->get_type() != MATRIX)
+        return false;
+    auto matrix = dynamic_cast<Matrix*>(argument);
+    if (matrix->rows() == 0 || matrix->cols() == 0)
+        return false;
+    *result = new RationalNumber(matrix->max());
+    return profiled(true, result);
+}
+
+bool reduce_frobenius2(GenericValue* argument, GenericValue** result)
+{
+    PROFILE_SCOPE(PROFILE_OPERATION);
+    Tracer::Span span("kernel", "frobenius2");
+    if (span.recording())
+        span.add_argument("argument", shape(argument));
+    if (argument->get_type() != MATRIX)
+        return false;
+    *result = new RationalNumber(dynamic_cast<Matrix*>(argument)->frobenius2());
+    return profiled(true, result);
 }
@@ -0,0 +1,86 @@
+#include <new>
+#include "value_pool.hpp"
+
+using namespace std;
+
+// Never destroyed, so values released during static destruction still find their pool
+ValuePool& ValuePool::instance()
+{
+    static auto pool = new ValuePool();
+    return *pool;
+}
+
+ValuePool::ValuePool() :
+    free_lists(), blocks(vector<char*>()), block_cursor(nullptr), block_left(0),
+    stats(Statistics{0, 0, 0, 0, 0})
+{}
+
+ValuePool::~ValuePool()
+{
+    for (char* block : blocks)
+        ::operator delete(block);
+}
+
+void* ValuePool::carve(size_t slot_size)
+{
+    if (block_left < slot_size)
+    {
+        block_cursor = static_cast<char*>(::operator new(BLOCK_SIZE));
+        block_left = BLOCK_SIZE;
+        blocks.push_back(block_cursor);
+    }
+    void* slot = block_cursor;
+    block_cursor += slot_size;
+    block_left -= slot_size;
+    return slot;
+}
+
+void* ValuePool::allocate(size_t size)
+{
+    lock_guard<mutex> guard(lock);
+    stats.live_objects++;
+    if (stats.live_objects > stats.peak_objects)
+        stats.peak_objects = stats.live_objects;
+
+    if (size == 0 || size > MAX_POOLED_SIZE)
+    {
+        stats.large_allocations++;
+        return ::operator new(size);
+    }
+
+    size_t size_class = (size - 1) / GRANULE;
+    FreeSlot* slot = free_lists[size_class];
+    if (slot != nullptr)
+    {
+        free_lists[size_class] = slot->next;
+        stats.pool_hits++;
+        return slot;
+    }
+    stats.pool_misses++;
+    return carve((size_class + 1) * GRANULE);
+}
+
+void ValuePool::deallocate(void* pointer, size_t size)
+{
+    if (pointer == nullptr)
+        return;
+    lock_guard<mutex> guard(lock);
+    stats.live_objects--;
+
+    if (size == 0 || size > MAX_POOLED_SIZE)
+    {
+        ::operator delete(pointer);
+        return;
+    }
+
+    size_t size_class = (size - 1) / GRANULE;
+    auto slot = static_cast<FreeSlot*>(pointer);
+    slot->next = free_lists[size_class];
+    free_lists[size_class] = slot;
+}
+
+ValuePool::Statistics ValuePool::statistics()
+{
+    lock_guard<mutex> guard(lock);
+    return stats;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// ==== Value pool declaration ====
+
+// Size-class allocator for value objects and small matrix storage.
+// Freed slots are kept on a per-class free list and handed out again before new memory is carved.
+
+struct ValuePool
+{
+    static const std::size_t GRANULE = 16;
+    static const std::size_t CLASSES_NUMBER = 16;
+    static const std::size_t MAX_POOLED_SIZE = GRANULE * CLASSES_NUMBER;
+    static const std::size_t BLOCK_SIZE = 64 * 1024;
+
+    struct Statistics
+    {
+        std::size_t live_objects;
+        std::size_t peak_objects;
+        std::size_t pool_hits;
+        std::size_t pool_misses;
+        std::size_t large_allocations;
+        inline double hit_rate() const
+        { return (pool_hits + pool_misses == 0) ? 0.0 : double(pool_hits) / double(pool_hits + pool_misses); }
+    };
+
+    static ValuePool& instance();
+
+    ValuePool();
+    ~ValuePool();
+    ValuePool(const ValuePool&) = delete;
+    ValuePool& operator=(const ValuePool&) = delete;
+
+    void* allocate(std::size_t size);
+    void deallocate(void* pointer, std::size_t size);
+
+    Statistics statistics();
+private:
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    void* carve(std::size_t slot_size);
+
+    FreeSlot* free_lists[CLASSES_NUMBER];
+    std::vector<char*> blocks;
+    char* block_cursor;
+    std::size_t block_left;
+    Statistics stats;
+    std::mutex lock;
+};
@@ -1,4 +1,11 @@
+#include <cctype>
+#include <charconv>
+#include <sstream>
+#include "../execution/arena.hpp"
 #include "../execution/context.hpp"
+#include "../execution/profiler.hpp"
+#include "../execution/thread_pool.hpp"
+#include "value_pool.hpp"
 #include "../parsing/parser.hpp"
 
 using namespace std;
@@ -11,44 +18,91 @@ GenericValue::GenericValue(ValueType object_type) :
 
 GenericValue* GenericValue::clone() { return new GenericValue(*this); }
 
+GenericValue* GenericValue::move_clone() { return clone(); }
+
+void GenericValue::print(ostream& out) const { out << to_string(); }
+
+void* GenericValue::operator new(size_t size)
+{
+    Arena* arena = Arena::active();
+    if (arena != nullptr)
+        return arena->allocate(size);
+    return ValuePool::instance().allocate(size);
+}
+
+void GenericValue::operator delete(void* pointer, size_t size)
+{
+    Arena* arena = Arena::active();
+    if (arena != nullptr && arena->owns(pointer))
+        arena->forget(pointer);
+    else
+        ValuePool::instance().deallocate(pointer, size);
+}
+
+// Matrix storage never lives in the arena: small matrices reuse pool slots, large ones go to the heap
+void* GenericValue::operator new[](size_t size)
+{
+    return ValuePool::instance().allocate(size);
+}
+
+void GenericValue::operator delete[](void* pointer, size_t size)
+{
+    ValuePool::instance().deallocate(pointer, size);
+}
+
+// ==== Literal scanning ====
+
+const char* skip_blanks(const char* position, const char* end)
+{
+    while (position != end && isspace(static_cast<unsigned char>(*position)))
+        position++;
+    return position;
+}
+
+bool scan_rational(const char*& position, const char* end, int& numerator, int& denominator)
+{
+    auto parsed = from_chars(position, end, numerator);
+    if (parsed.ec != errc())
+        return false;
+    denominator = 1;
+    const char* slash = skip_blanks(parsed.ptr, end);
+    if (slash != end && *slash == '/')
+    {
+        const char* digits = skip_blanks(slash + 1, end);
+        if (digits == end || *digits == '-')
+            return false;
+        parsed = from_chars(digits, end, denominator);
+        if (parsed.ec != errc() || denominator == 0)
+            return false;
+    }
+    position = parsed.ptr;
+    return true;
+}
+
 // ==== RationalNumber implementation ====
 
 const string RationalNumber::REG_EXP_STR = R"((?:-?\d+\s*/\s*\d+|-?\d+))";
 const regex RationalNumber::REG_EXP = regex(RationalNumber::REG_EXP_STR);
 
-bool RationalNumber::is_correct_str(std::string str_num)
+// The same grammar as REG_EXP, checked without copying the text; numbers out of int range are rejected
+bool RationalNumber::is_correct_str(string_view str_num)
 {
     str_num = trim(str_num);
-    smatch number_match;
-    if (!regex_match(str_num, number_match, REG_EXP))
-        return false;
-    string::size_type slash_pos = str_num.find('/');
+    const char* position = str_num.data();
+    const char* end = position + str_num.size();
     int numerator, denominator;
-    if (slash_pos == string::npos)
-    {
-        try
-        {
-            numerator = stoi(str_num);
-        }
-        catch (invalid_argument& e) { return false; }
-        return true;
-    }
-    else
-    {
-        try
-        {
-            numerator = stoi(str_num.substr(0, slash_pos));
-            denominator = stoi(str_num.substr(slash_pos + 1));
-            if (denominator == 0)
-                throw invalid_argument("Zero division error");
-        }
-        catch (invalid_argument& e) { return false; }
-        return true;
-    }
+    return scan_rational(position, end, numerator, denominator) && position == end;
 }
 
+// Keeps the sign in the numerator, so that quotients by negative numbers print as -a/b
 void RationalNumber::simplify()
 {
+    PROFILE_SCOPE(PROFILE_SIMPLIFY);
+    if (denominator < 0)
+    {
+        numerator = -numerator;
+        denominator = -denominator;
+    }
     for (int d = 2; d <= denominator; d++)
         while (numerator % d == 0 && denominator % d == 0)
         {
@@ -85,11 +139,26 @@ RationalNumber::RationalNumber(int num, int den) :
     simplify();
 }
 
+RationalNumber RationalNumber::reduced(int num, int den)
+{
+    RationalNumber number;
+    number.numerator = num;
+    number.denominator = den;
+    return number;
+}
+
 RationalNumber::RationalNumber(const RationalNumber& other) :
         GenericValue(RATIONAL_NUMBER), numerator(other.numerator), denominator(other.denominator)
 {}
 
-GenericValue* RationalNumber::clone() { return new RationalNumber(*this); }
+GenericValue* RationalNumber::clone()
+{
+    PROFILE_SCOPE(PROFILE_CLONE);
+    PROFILE_COUNT(PROFILE_CLONE, 1, 1, sizeof(RationalNumber));
+    return new RationalNumber(*this);
+}
+
+GenericValue* RationalNumber::move_clone() { return clone(); }
 
 RationalNumber& RationalNumber::operator=(const RationalNumber& other)
 {
@@ -98,12 +167,29 @@ RationalNumber& RationalNumber::operator=(const RationalNumber& other)
     return *this;
 }
 
+const int RationalNumber::TEXT_SIZE = 24;
+
+int RationalNumber::format(char* text) const
+{
+    char* end = to_chars(text, text + TEXT_SIZE, numerator).ptr;
+    if (denominator != 1)
+    {
+        *end++ = '/';
+        end = to_chars(end, text + TEXT_SIZE, denominator).ptr;
+    }
+    return int(end - text);
+}
+
 string RationalNumber::to_string() const
 {
-    if (denominator == 1)
-        return std::to_string(numerator);
-    else
-        return std::to_string(numerator) + "/" + std::to_string(denominator);
+    char text[TEXT_SIZE];
+    return string(text, format(text));
+}
+
+void RationalNumber::print(ostream& out) const
+{
+    char text[TEXT_SIZE];
+    out.write(text, format(text));
 }
 
 RationalNumber RationalNumber::operator+(const RationalNumber& other) const
@@ -133,102 +219,89 @@ RationalNumber RationalNumber::operator/(const RationalNumber& other) const
     return RationalNumber(numerator*other.denominator, denominator*other.numerator);
 }
 
+// Denominators are positive, so cross multiplication keeps the order
+bool RationalNumber::operator<(const RationalNumber& other) const
+{
+    return (long long)numerator * other.denominator < (long long)other.numerator * denominator;
+}
 
-// ==== Matrix implementation ====
 
-const regex Matrix::ROW_REG_EXP = regex(
-        "(?:" + RationalNumber::REG_EXP_STR + "\\s*)+"
-);
-const regex Matrix::REG_EXP = regex(
-        "\\[\\s*(?:(?:" + RationalNumber::REG_EXP_STR + "\\s+)*" + RationalNumber::REG_EXP_STR + "\\s*;\\s*)*(?:"
-        + RationalNumber::REG_EXP_STR + "\\s+)*" + RationalNumber::REG_EXP_STR + "\\s*\\]"
-);
+// ==== Matrix implementation ====
 
-bool Matrix::is_correct_str(string str_matrix)
+// One pass over "[a b; c d]": elements are separated by blanks, rows by ';' and every row must
+// have the same length. Only the shape is computed when elements is null.
+bool Matrix::scan(string_view str_matrix, RationalNumber* elements, int& rows, int& cols)
 {
-    str_matrix = trim(str_matrix);
-
-    cmatch matrix_match_result;
-
-    if (!regex_match(str_matrix.c_str(), matrix_match_result, Matrix::REG_EXP))
+    const char* end = str_matrix.data() + str_matrix.size();
+    const char* position = skip_blanks(str_matrix.data(), end);
+    if (position == end || *position != '[')
         return false;
-    else
-    {
-        smatch rows_match, columns_match, elements_match;
-
-        if (!regex_search(str_matrix, rows_match, Matrix::ROW_REG_EXP))
-            return false;
-        string row = rows_match[0];
+    position++;
 
-        int columns_number = 0, c;
-        while (regex_search(row, columns_match, RationalNumber::REG_EXP))
+    rows = 0;
+    cols = 0;
+    int k = 0;
+    while (true)
+    {
+        position = skip_blanks(position, end);
+        int row_length = 0;
+        while (true)
         {
-            if (!RationalNumber::is_correct_str(columns_match[0]))
+            int numerator, denominator;
+            if (!scan_rational(position, end, numerator, denominator))
                 return false;
-            columns_number++;
-            row = columns_match.suffix().str();
-        }
-        str_matrix = rows_match.suffix().str();
+            if (elements != nullptr)
+                elements[k] = RationalNumber(numerator, denominator);
+            k++;
+            row_length++;
 
-        while (regex_search(str_matrix, rows_match, Matrix::ROW_REG_EXP))
-        {
-            row = rows_match[0];
-            c = 0;
-            while (regex_search(row, columns_match, RationalNumber::REG_EXP))
+            const char* next = skip_blanks(position, end);
+            if (next != end && (*next == ';' || *next == ']'))
             {
-                if (!RationalNumber::is_correct_str(columns_match[0]))
-                    return false;
-                c++;
-                row = columns_match.suffix().str();
+                position = next;
+                break;
             }
-            if (c != columns_number)
+            if (next == position)
                 return false;
-            str_matrix = rows_match.suffix().str();
+            position = next;
         }
-
-        return true;
-    }    
+        if (rows == 0)
+            cols = row_length;
+        else if (row_length != cols)
+            return false;
+        rows++;
+        if (*position++ == ']')
+            break;
+    }
+    return skip_blanks(position, end) == end;
 }
 
-Matrix::Matrix(string str_matrix) :
-        GenericValue(MATRIX)
+bool Matrix::is_correct_str(string_view str_matrix)
 {
-    string str_copy = str_matrix, row;
-    str_matrix = trim(str_matrix);
-    smatch elements_match, columns_match, rows_match;
+    int rows, cols;
+    return scan(str_matrix, nullptr, rows, cols);
+}
 
-    regex_search(str_copy, rows_match, Matrix::ROW_REG_EXP);
-    row = rows_match[0];
-    cols_ = 0, rows_ = 1;
-    while (regex_search(row, columns_match, RationalNumber::REG_EXP))
-    {
-        cols_++;
-        row = columns_match.suffix().str();
-    }
-    str_copy = rows_match.suffix().str();
-    while (regex_search(str_copy, rows_match, Matrix::ROW_REG_EXP))
-    {
-        rows_++;
-        str_copy = rows_match.suffix().str();
-    }
+Matrix::Matrix(string_view str_matrix) :
+        GenericValue(MATRIX), contents(nullptr), rows_(0), cols_(0), owns_elements(true)
+{
+    PROFILE_SCOPE(PROFILE_MATRIX_CONSTRUCT);
+    if (!scan(str_matrix, nullptr, rows_, cols_))
+        return;
+    PROFILE_COUNT(PROFILE_MATRIX_CONSTRUCT, uint64_t(rows_) * cols_, 2, 0);
 
     contents = new RationalNumber*[rows_];
     contents[0] = new RationalNumber[rows_ * cols_];
     for (int i = 1; i != rows_; i++)
         contents[i] = contents[i - 1] + cols_;
-
-    int k = 0;
-    while (regex_search(str_matrix, elements_match, RationalNumber::REG_EXP))
-    {
-        contents[k / cols_][k % cols_] = RationalNumber(elements_match[0].str());
-        str_matrix = elements_match.suffix().str();
-        k++;
-    }
+    scan(str_matrix, contents[0], rows_, cols_);
 }
 
 Matrix::Matrix(int rows, int cols) :
-        GenericValue(MATRIX), contents(nullptr), rows_(rows), cols_(cols)
+        GenericValue(MATRIX), contents(nullptr), rows_(rows), cols_(cols), owns_elements(true)
 {
+    PROFILE_SCOPE(PROFILE_MATRIX_CONSTRUCT);
+    PROFILE_COUNT(PROFILE_MATRIX_CONSTRUCT, uint64_t(rows_) * cols_, 2, 0);
     contents = new RationalNumber*[rows_];
     contents[0] = new RationalNumber[rows_ * cols_];
     for (int i = 1; i != rows_; i++)
@@ -236,12 +309,27 @@ Matrix::Matrix(int rows, int cols) :
 }
 
 Matrix::Matrix() :
-        GenericValue(MATRIX), contents(nullptr), rows_(0), cols_(0)
+        GenericValue(MATRIX), contents(nullptr), rows_(0), cols_(0), owns_elements(true)
 {}
 
+Matrix Matrix::view(RationalNumber* elements, int rows, int cols)
+{
+    Matrix result;
+    result.rows_ = rows;
+    result.cols_ = cols;
+    result.owns_elements = false;
+    result.contents = new RationalNumber*[rows];
+    for (int i = 0; i != rows; i++)
+        result.contents[i] = elements + std::size_t(i) * cols;
+    return result;
+}
+
 Matrix::Matrix(const Matrix& other) :
-        GenericValue(MATRIX)
+        GenericValue(MATRIX), owns_elements(true)
 {
+    PROFILE_SCOPE(PROFILE_MATRIX_CONSTRUCT);
+    PROFILE_COUNT(PROFILE_MATRIX_CONSTRUCT, uint64_t(other.rows_) * other.cols_, 2,
+                  uint64_t(other.rows_) * other.cols_ * sizeof(RationalNumber));
     rows_ = other.rows_;
     cols_ = other.cols_;
     contents = new RationalNumber*[rows_];
@@ -254,12 +342,28 @@ Matrix::Matrix(const Matrix& other) :
             contents[i][j] = other.contents[i][j];
 }
 
+Matrix::Matrix(Matrix&& other) noexcept :
+        GenericValue(MATRIX), contents(other.contents), rows_(other.rows_), cols_(other.cols_),
+        owns_elements(other.owns_elements)
+{
+    other.contents = nullptr;
+    other.rows_ = 0;
+    other.cols_ = 0;
+    other.owns_elements = true;
+}
+
 void Matrix::clear()
 {
-    if (contents != nullptr) { delete [] contents[0]; delete [] contents; }
+    if (contents != nullptr)
+    {
+        if (owns_elements)
+            delete [] contents[0];
+        delete [] contents;
+    }
     contents = nullptr;
     rows_ = 0;
     cols_ = 0;
+    owns_elements = true;
 }
 
 Matrix::~Matrix()
@@ -267,7 +371,20 @@ Matrix::~Matrix()
     clear();
 }
 
-GenericValue* Matrix::clone() { return new Matrix(*this); }
+GenericValue* Matrix::clone()
+{
+    PROFILE_SCOPE(PROFILE_CLONE);
+    PROFILE_COUNT(PROFILE_CLONE, uint64_t(rows_) * cols_, 1, byte_size());
+    return new Matrix(*this);
+}
+
+// Takes over the storage, only the object itself is allocated
+GenericValue* Matrix::move_clone()
+{
+    PROFILE_SCOPE(PROFILE_CLONE);
+    PROFILE_COUNT(PROFILE_CLONE, 0, 1, 0);
+    return new Matrix(std::move(*this));
+}
 
 Matrix& Matrix::operator=(const Matrix& other)
 {
@@ -275,7 +392,7 @@ Matrix& Matrix::operator=(const Matrix& other)
     {
         clear();
         rows_ = other.rows_;
-        cols_ = other.rows_;
+        cols_ = other.cols_;
         contents = new RationalNumber*[rows_];
         contents[0] = new RationalNumber[rows_ * cols_];
         for (int i = 1; i != rows_; i++)
@@ -288,6 +405,23 @@ Matrix& Matrix::operator=(const Matrix& other)
     return *this;
 }
 
+Matrix& Matrix::operator=(Matrix&& other) noexcept
+{
+    if (this != &other)
+    {
+        clear();
+        contents = other.contents;
+        rows_ = other.rows_;
+        cols_ = other.cols_;
+        owns_elements = other.owns_elements;
+        other.contents = nullptr;
+        other.rows_ = 0;
+        other.cols_ = 0;
+        other.owns_elements = true;
+    }
+    return *this;
+}
+
 void Matrix::transpose()
 {
     int new_rows = cols_, new_cols = rows_;
@@ -366,22 +500,217 @@ Matrix operator*(const RationalNumber& multiplier, const Matrix& m)
     return result;
 }
 
+Matrix Matrix::multiply_add(const RationalNumber& alpha, const Matrix& a, const Matrix& b,
+                            const RationalNumber& beta, const Matrix* c)
+{
+    Matrix result(a.rows_, b.cols_);
+    for (int i = 0; i != a.rows_; i++)
+        for (int j = 0; j != b.cols_; j++)
+        {
+            RationalNumber element(0, 1);
+            for (int k = 0; k != a.cols_; k++)
+                element = element + a.contents[i][k] * b.contents[k][j];
+            element = alpha * element;
+            if (c != nullptr)
+                element = element + beta * c->contents[i][j];
+            result.contents[i][j] = element;
+        }
+    return result;
+}
+
+Matrix Matrix::scaled_add(const RationalNumber& alpha, const Matrix& x,
+                          const RationalNumber& beta, const Matrix* y)
+{
+    Matrix result(x.rows_, x.cols_);
+    for (int i = 0; i != x.rows_; i++)
+        for (int j = 0; j != x.cols_; j++)
+        {
+            if (y != nullptr)
+                result.contents[i][j] = alpha * x.contents[i][j] + beta * y->contents[i][j];
+            else
+                result.contents[i][j] = alpha * x.contents[i][j];
+        }
+    return result;
+}
+
+Matrix Matrix::hadamard_product(const Matrix& other) const
+{
+    Matrix result(rows_, cols_);
+    for (int i = 0; i != rows_; i++)
+    {
+        const RationalNumber* left = contents[i];
+        const RationalNumber* right = other.contents[i];
+        RationalNumber* row = result.contents[i];
+        for (int j = 0; j != cols_; j++)
+            row[j] = left[j] * right[j];
+    }
+    return result;
+}
+
+Matrix Matrix::hadamard_quotient(const Matrix& other) const
+{
+    Matrix result(rows_, cols_);
+    for (int i = 0; i != rows_; i++)
+    {
+        const RationalNumber* left = contents[i];
+        const RationalNumber* right = other.contents[i];
+        RationalNumber* row = result.contents[i];
+        for (int j = 0; j != cols_; j++)
+            row[j] = left[j] / right[j];
+    }
+    return result;
+}
+
+bool Matrix::has_zero_element() const
+{
+    for (int i = 0; i != rows_; i++)
+        for (int j = 0; j != cols_; j++)
+            if (contents[i][j].num() == 0)
+                return true;
+    return false;
+}
+
+const int Matrix::PARALLEL_REDUCTION_SIZE = 1 << 14;
+
+// Reduces rows [0, rows) with reduce_block, splitting them into blocks for the shared thread pool
+// when there are enough elements. Partial results are combined in block order.
+static RationalNumber reduce_rows(int rows, int cols, const function<RationalNumber(int, int)>& reduce_block,
+                                  RationalNumber (*combine)(const RationalNumber&, const RationalNumber&))
+{
+    if (int64_t(rows) * cols < Matrix::PARALLEL_REDUCTION_SIZE || rows < 2)
+        return reduce_block(0, rows);
+    size_t blocks = min(size_t(rows), 4 * size_t(ThreadPool::shared().size()));
+    vector<RationalNumber> partial(blocks);
+    ThreadPool::shared().parallel_for(blocks, [&](size_t k)
+    {
+        partial[k] = reduce_block(int(k * rows / blocks), int((k + 1) * rows / blocks));
+    });
+    RationalNumber result = partial[0];
+    for (size_t k = 1; k != blocks; k++)
+        result = combine(result, partial[k]);
+    return result;
+}
+
+static RationalNumber add_rationals(const RationalNumber& left, const RationalNumber& right)
+{
+    return left + right;
+}
+
+static RationalNumber larger_rational(const RationalNumber& left, const RationalNumber& right)
+{
+    return left < right ? right : left;
+}
+
+RationalNumber Matrix::sum() const
+{
+    return reduce_rows(rows_, cols_, [this](int begin, int end)
+    {
+        RationalNumber total(0, 1);
+        for (int i = begin; i != end; i++)
+            for (int j = 0; j != cols_; j++)
+                total = total + contents[i][j];
+        return total;
+    }, add_rationals);
+}
+
+RationalNumber Matrix::trace() const
+{
+    RationalNumber total(0, 1);
+    for (int i = 0; i != rows_; i++)
+        total = total + contents[i][i];
+    return total;
+}
+
+RationalNumber Matrix::max() const
+{
+    return reduce_rows(rows_, cols_, [this](int begin, int end)
+    {
+        RationalNumber largest = contents[begin][0];
+        for (int i = begin; i != end; i++)
+            for (int j = 0; j != cols_; j++)
+                if (largest < contents[i][j])
+                    largest = contents[i][j];
+        return largest;
+    }, larger_rational);
+}
+
+RationalNumber Matrix::frobenius2() const
+{
+    return reduce_rows(rows_, cols_, [this](int begin, int end)
+    {
+        RationalNumber total(0, 1);
+        for (int i = begin; i != end; i++)
+            for (int j = 0; j != cols_; j++)
+                total = total + contents[i][j] * contents[i][j];
+        return total;
+    }, add_rationals);
+}
+
+const int Matrix::SUMMARY_CORNER = 3;
+
 std::string Matrix::to_string() const
 {
+    ostringstream result;
+    print(result);
+    return result.str();
+}
+
+// Elements go straight into the stream buffer, skipping the per-call stream bookkeeping
+static void print_row(streambuf* out, const RationalNumber* row, int begin, int end)
+{
+    char text[RationalNumber::TEXT_SIZE + 1];
+    for (int j = begin; j < end; j++)
+    {
+        int length = row[j].format(text);
+        text[length++] = ' ';
+        out->sputn(text, length);
+    }
+}
 
+void Matrix::print(ostream& out) const
+{
     if (contents == nullptr || rows_ == 0 || cols_ == 0)
-        return "( Empty matrix )";
-    else
     {
-        string result = "(\n";
-        for (int i = 0; i != rows_; i++)
+        out << "( Empty matrix )";
+        return;
+    }
+    streambuf* buffer = out.rdbuf();
+    buffer->sputn("(\n", 2);
+    for (int i = 0; i != rows_; i++)
+    {
+        buffer->sputc('\t');
+        print_row(buffer, contents[i], 0, cols_);
+        buffer->sputc('\n');
+    }
+    buffer->sputc(')');
+}
+
+void Matrix::print_summary(ostream& out) const
+{
+    if (rows_ <= 2 * SUMMARY_CORNER && cols_ <= 2 * SUMMARY_CORNER)
+    {
+        print(out);
+        return;
+    }
+    streambuf* buffer = out.rdbuf();
+    out << "( " << rows_ << "x" << cols_ << " matrix\n";
+    for (int i = 0; i != rows_; i++)
+    {
+        if (rows_ > 2 * SUMMARY_CORNER && i == SUMMARY_CORNER)
+        {
+            buffer->sputn("\t...\n", 5);
+            i = rows_ - SUMMARY_CORNER;
+        }
+        buffer->sputc('\t');
+        if (cols_ > 2 * SUMMARY_CORNER)
         {
-            result += "\t";
-            for (int j = 0; j < cols_; j++)
-                result += contents[i][j].to_string() + " ";
-            result += "\n";
+            print_row(buffer, contents[i], 0, SUMMARY_CORNER);
+            buffer->sputn("... ", 4);
+            print_row(buffer, contents[i], cols_ - SUMMARY_CORNER, cols_);
         }
-        result += ")";
-        return result;
+        else
+            print_row(buffer, contents[i], 0, cols_);
+        buffer->sputc('\n');
     }
+    buffer->sputc(')');
 }
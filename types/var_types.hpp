@@ -1,5 +1,7 @@
 #pragma once
+#include <iosfwd>
 #include <string>
+#include <string_view>
 #include <regex>
 
 enum ValueType
@@ -16,10 +18,19 @@ struct GenericValue
     virtual ~GenericValue() = default;
 
     virtual GenericValue* clone();
+    virtual GenericValue* move_clone();
+
+    static void* operator new(std::size_t size);
+    static void operator delete(void* pointer, std::size_t size);
+    static void* operator new[](std::size_t size);
+    static void operator delete[](void* pointer, std::size_t size);
 
     inline ValueType get_type() { return type; }
 
     virtual std::string to_string() const { return std::string(); };
+    // Writes the same text as to_string() without building it first
+    virtual void print(std::ostream& out) const;
+    virtual std::size_t byte_size() const { return sizeof(GenericValue); }
 private:
     ValueType type;
 };
@@ -28,7 +39,7 @@ private:
 
 struct RationalNumber : GenericValue
 {
-    static bool is_correct_str(std::string str_num);
+    static bool is_correct_str(std::string_view str_num);
     static const std::string REG_EXP_STR;
     static const std::regex REG_EXP;
 
@@ -36,9 +47,13 @@ struct RationalNumber : GenericValue
     RationalNumber(const RationalNumber& other);
     RationalNumber(int num, int den);
     RationalNumber();
+    // Number already in lowest terms with a positive denominator, e.g. read back from num() and
+    // den() of a stored value; unlike RationalNumber(num, den) it is not simplified again
+    static RationalNumber reduced(int num, int den);
     ~RationalNumber() override = default;
 
     GenericValue* clone() override;
+    GenericValue* move_clone() override;
 
     RationalNumber& operator=(const RationalNumber& other);
 
@@ -47,11 +62,17 @@ struct RationalNumber : GenericValue
     RationalNumber operator-(const RationalNumber& other) const;
     RationalNumber operator*(const RationalNumber& other) const;
     RationalNumber operator/(const RationalNumber& other) const;
+    bool operator<(const RationalNumber& other) const;
 
     inline int num() const { return numerator; }
     inline int den() const { return denominator; }
 
     std::string to_string() const override;
+    void print(std::ostream& out) const override;
+    // Writes the to_string() text into text, which must hold TEXT_SIZE chars; returns its length
+    int format(char* text) const;
+    static const int TEXT_SIZE;
+    inline std::size_t byte_size() const override { return sizeof(RationalNumber); }
 private:
     void simplify();
     int numerator;
@@ -62,18 +83,22 @@ private:
 
 struct Matrix : GenericValue
 {
-    static bool is_correct_str(std::string str_matrix);
-    static const std::regex ROW_REG_EXP;
-    static const std::regex REG_EXP;
+    static bool is_correct_str(std::string_view str_matrix);
 
-    explicit Matrix(std::string str_matrix);
+    explicit Matrix(std::string_view str_matrix);
     Matrix(int rows, int cols);
     Matrix();
+    // Non-owning matrix over rows * cols row-major elements kept alive by the caller.
+    // Copies and results of operations own their storage as usual.
+    static Matrix view(RationalNumber* elements, int rows, int cols);
     Matrix(const Matrix& other);
+    Matrix(Matrix&& other) noexcept;
     Matrix& operator=(const Matrix& other);
+    Matrix& operator=(Matrix&& other) noexcept;
     ~Matrix() override;
 
     GenericValue* clone() override;
+    GenericValue* move_clone() override;
 
     void transpose();
     Matrix operator+(const Matrix& other) const;
@@ -83,25 +108,90 @@ struct Matrix : GenericValue
     Matrix operator*(const RationalNumber& multiplier) const;
     friend Matrix operator*(const RationalNumber& multiplier, const Matrix& m);
 
+    // Fused kernels: alpha * a * b + beta * c and alpha * x + beta * y computed into one result
+    // without intermediate matrices; c and y may be null
+    static Matrix multiply_add(const RationalNumber& alpha, const Matrix& a, const Matrix& b,
+                               const RationalNumber& beta, const Matrix* c);
+    static Matrix scaled_add(const RationalNumber& alpha, const Matrix& x,
+                             const RationalNumber& beta, const Matrix* y);
+    // Element-wise product and quotient of matrices of the same size; the quotient needs
+    // other to have no zero element
+    Matrix hadamard_product(const Matrix& other) const;
+    Matrix hadamard_quotient(const Matrix& other) const;
+    bool has_zero_element() const;
+
+    // Reductions; sum, max and frobenius2 combine row blocks reduced on the shared thread pool
+    // once a matrix has PARALLEL_REDUCTION_SIZE elements. trace() needs a square matrix.
+    static const int PARALLEL_REDUCTION_SIZE;
+    RationalNumber sum() const;
+    RationalNumber trace() const;
+    RationalNumber max() const;
+    // Sum of the squared elements
+    RationalNumber frobenius2() const;
+
+    inline int rows() const { return rows_; }
+    inline int cols() const { return cols_; }
+    inline const RationalNumber& at(int i, int j) const { return contents[i][j]; }
+    inline RationalNumber& at(int i, int j) { return contents[i][j]; }
     bool inline has_same_size(const Matrix& other) const { return (rows_ == other.rows_ && cols_ == other.cols_); }
     bool inline is_multipliable_with(const Matrix& other) const { return (cols_ == other.rows_); }
 
     std::string to_string() const override;
+    void print(std::ostream& out) const override;
+    // Shape and the SUMMARY_CORNER first and last rows and columns only
+    void print_summary(std::ostream& out) const;
+    static const int SUMMARY_CORNER;
+    // The elements of a view belong to its caller and are not counted
+    inline std::size_t byte_size() const override
+    { return owns_elements ? byte_size(rows_, cols_) : sizeof(Matrix) + rows_ * sizeof(RationalNumber*); }
+    static inline std::size_t byte_size(int rows, int cols)
+    { return sizeof(Matrix) + rows * sizeof(RationalNumber*) + std::size_t(rows) * cols * sizeof(RationalNumber); }
+    inline bool is_view() const { return !owns_elements; }
 private:
+    static bool scan(std::string_view str_matrix, RationalNumber* elements, int& rows, int& cols);
     void clear();
     RationalNumber** contents;
     int rows_;
     int cols_;
+    bool owns_elements;
 };
 
+// ==== Literal scanning declaration ====
+
+// Shared by matrix and number literals and by imported CSV files, over [position, end) without copying
+const char* skip_blanks(const char* position, const char* end);
+// Reads "-?\d+" or "-?\d+ / \d+" with a nonzero denominator and moves position past it;
+// numbers out of int range are rejected
+bool scan_rational(const char*& position, const char* end, int& numerator, int& denominator);
+
 // ==== Binary operations declaration ====
 
 bool add(GenericValue* left, GenericValue* right, GenericValue** result);
 bool subtract(GenericValue* left, GenericValue* right, GenericValue** result);
 bool multiply(GenericValue* left, GenericValue* right, GenericValue** result);
 bool divide(GenericValue* left, GenericValue* right, GenericValue** result);
+// .* and ./ of matrices of the same size; with a scalar operand they are * and /
+bool elementwise_multiply(GenericValue* left, GenericValue* right, GenericValue** result);
+bool elementwise_divide(GenericValue* left, GenericValue* right, GenericValue** result);
+bool binary_operation(const std::string& op, GenericValue* left, GenericValue* right, GenericValue** result);
+
+// ==== Fused operations declaration ====
+
+bool multiply_add(const RationalNumber& alpha, GenericValue* a, GenericValue* b,
+                  const RationalNumber& beta, GenericValue* c, GenericValue** result);
+bool scaled_add(const RationalNumber& alpha, GenericValue* x,
+                const RationalNumber& beta, GenericValue* y, GenericValue** result);
 
 // ==== Unary operations declarations ====
 
 bool T(GenericValue* argument, GenericValue** result);
-bool unary_minus(GenericValue* argument, GenericValue** result);
\ No newline at end of file
+bool unary_minus(GenericValue* argument, GenericValue** result);
+
+// ==== Reductions declaration ====
+
+// sum, trace, max and frobenius2 of a matrix, each giving a rational number
+
+bool reduce_sum(GenericValue* argument, GenericValue** result);
+bool reduce_trace(GenericValue* argument, GenericValue** result);
+bool reduce_max(GenericValue* argument, GenericValue** result);
+bool reduce_frobenius2(GenericValue* argument, GenericValue** result);
\ No newline at end of file